@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>		/* exit()  */
+#include <fcntl.h>		/* open()  */
+#include <unistd.h>		/* close() */
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "hrt_mod.h"
+
+#define RING "/dev/" DEVICE_NAME
+
+static volatile sig_atomic_t done;
+
+static void stop(int sig)
+{
+	done = 1;
+}
+
+
+/*
+ *	drain
+ *
+ *	Details:
+ *		- writes the samples the kernel published in ring r to fd,
+ *		  straight from the mapping, and frees them by storing tail
+ *		- a wrapped run of samples takes two writes
+ *
+ *	Return Value:
+ *		- samples written, -1 on a write error
+ */
+static long drain(struct hrt_ring *r, int fd)
+{
+	struct hrt_sample *data = (struct hrt_sample *)((char *)r + r->data);
+	__u64 head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	__u64 tail = r->tail;
+	long n = head - tail;
+
+	while(tail != head)
+	{
+		__u64 i = tail & (r->size - 1);
+		__u64 run = head - tail;
+		size_t len;
+
+		if(run > r->size - i)
+		{
+			run = r->size - i;
+		}
+		len = run * sizeof(struct hrt_sample);
+		if(write(fd, &data[i], len) != (ssize_t)len)
+		{
+			return -1;
+		}
+		tail += run;
+	}
+
+	__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	return n;
+}
+
+
+/*
+ *	hrt_consumer - streams the samples of hrt_mod to a binary file
+ *
+ *	usage: ./hrt_consumer <file> [seconds]
+ *
+ *	The file is a sequence of struct hrt_sample, in the order they are
+ *	read from the rings, so per CPU in time order. Stops after "seconds"
+ *	or at ^C, and prints how many samples were written and dropped.
+ */
+int main(int argc, char *argv[])
+{
+	struct hrt_ring *first, *r;
+	struct timespec nap = { 0, 1000000 };
+	unsigned long long samples = 0, dropped = 0;
+	size_t len;
+	char *map;
+	int fd, out, i;
+	long n, idle = 0;
+
+	if(argc < 2)
+	{
+		printf("usage: %s <file> [seconds]\n", argv[0]);
+		exit(-1);
+	}
+
+	fd = open(RING, O_RDWR);
+	if(fd == -1)
+	{
+		printf("Error opening file %s\n", RING);
+		exit(-1);
+	}
+
+	/* the first head says how many rings there are and how large */
+	first = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	if(first == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(-1);
+	}
+	len = first->nr_rings * first->stride;
+	munmap(first, sysconf(_SC_PAGESIZE));
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(-1);
+	}
+	first = (struct hrt_ring *)map;
+
+	out = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(out == -1)
+	{
+		printf("Error opening file %s\n", argv[1]);
+		exit(-1);
+	}
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	if(argc > 2)
+	{
+		signal(SIGALRM, stop);
+		alarm(atoi(argv[2]));
+	}
+
+	/* count only the samples dropped from now on */
+	for(i = 0; i < first->nr_rings; i++)
+	{
+		r = (struct hrt_ring *)(map + i * first->stride);
+		dropped -= r->dropped;
+	}
+
+	while(!done)
+	{
+		idle = 1;
+		for(i = 0; i < first->nr_rings; i++)
+		{
+			r = (struct hrt_ring *)(map + i * first->stride);
+			n = drain(r, out);
+			if(n < 0)
+			{
+				perror("write");
+				exit(-1);
+			}
+			samples += n;
+			idle = idle && n == 0;
+		}
+
+		/* nothing new in any ring, wait 1 ms */
+		if(idle)
+		{
+			nanosleep(&nap, NULL);
+		}
+	}
+
+	for(i = 0; i < first->nr_rings; i++)
+	{
+		r = (struct hrt_ring *)(map + i * first->stride);
+		dropped += r->dropped;
+	}
+
+	printf("%llu samples (%llu bytes) written to %s, %llu dropped\n",
+		samples, samples * sizeof(struct hrt_sample), argv[1], dropped);
+
+	close(out);
+	munmap(map, len);
+	close(fd);
+	return 0;
+}
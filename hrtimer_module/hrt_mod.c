@@ -4,102 +4,1093 @@
 #include <linux/ktime.h>
 #include <linux/hrtimer.h>
 #include <linux/jiffies.h>
+#include <linux/moduleparam.h>
+#include <linux/cpumask.h>
+#include <linux/cpu.h>
+#include <linux/smp.h>
+#include <linux/slab.h>
+#include <linux/atomic.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kernel_stat.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/version.h>
 
-#define MAX_ITR 15
+#include "hrt_mod.h"
 
-static struct hrtimer my_hrt;
+static unsigned int nr_timers = 1;
+module_param(nr_timers, uint, 0444);
+MODULE_PARM_DESC(nr_timers, "number of timers to arm (1 - 10000)");
+
+static unsigned long period_us = HRT_DEFAULT_PERIOD_US;
+module_param(period_us, ulong, 0444);
+MODULE_PARM_DESC(period_us, "timer period in microseconds");
+
+static unsigned int max_itr = MAX_ITR;
+module_param(max_itr, uint, 0444);
+MODULE_PARM_DESC(max_itr, "expiries of every timer, 0: until the module is removed");
+
+static char *cpus;
+module_param(cpus, charp, 0444);
+MODULE_PARM_DESC(cpus, "CPU list (e.g. 0-3,6) the timers are pinned to, round robin; not pinned if unset");
+
+static bool spread;
+module_param(spread, bool, 0444);
+MODULE_PARM_DESC(spread, "spread the first expiries over one period instead of expiring all timers together");
+
+static char *modes;
+module_param(modes, charp, 0444);
+MODULE_PARM_DESC(modes, "hrtimer modes run back to back, e.g. rel,soft,hard,pinned,pinned_soft,pinned_hard (default: rel, or pinned with cpus)");
+
+static unsigned int ring_size = HRT_RING_SIZE;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "samples in the ring of every CPU, rounded up to a power of two; 0: no " DEVICE_NAME " device");
+
+
+/* modes the "modes" parameter can name */
+enum { MODE_REL, MODE_SOFT, MODE_HARD, MODE_PINNED, MODE_PINNED_SOFT,
+	MODE_PINNED_HARD };
+
+static const struct
+{
+	const char *name;
+	enum hrtimer_mode mode;
+}
+hrt_modes[] =
+{
+	[MODE_REL]		= { "rel",		HRTIMER_MODE_REL },
+	[MODE_SOFT]		= { "soft",		HRTIMER_MODE_REL_SOFT },
+	[MODE_HARD]		= { "hard",		HRTIMER_MODE_REL_HARD },
+	[MODE_PINNED]		= { "pinned",		HRTIMER_MODE_REL_PINNED },
+	[MODE_PINNED_SOFT]	= { "pinned_soft",	HRTIMER_MODE_REL_PINNED_SOFT },
+	[MODE_PINNED_HARD]	= { "pinned_hard",	HRTIMER_MODE_REL_PINNED_HARD },
+};
+
+
+/*
+ *	struct hrt_timer - one timer and what its expiries cost
+ *
+ *	@timer		: the hrtimer
+ *	@cpu		: CPU the timer is pinned to, -1 if not pinned
+ *	@itr		: expiries so far
+ *	@overruns	: periods missed because an expiry came too late
+ *	@cost_sum_ns	: sum of the time spent in the callback
+ *	@cost_max_ns	: largest time spent in the callback
+ *
+ *	Only the callback of the timer writes these, so no lock is needed.
+ */
+struct hrt_timer
+{
+	struct hrtimer timer;
+	int cpu;
+	unsigned int itr;
+	u64 overruns;
+	u64 cost_sum_ns;
+	u64 cost_max_ns;
+};
+
+/*
+ *	struct hrt_result - what one mode cost
+ *
+ *	@mode		: index into hrt_modes
+ *	@expiries	: expiries of all timers
+ *	@overruns	: periods missed
+ *	@elapsed_ns	: from starting the timers to the last expiry
+ *	@late_*		: lateness min, mean, percentiles and max
+ *	@cb_mean_ns	: mean time spent in a callback
+ *	@irq_ns		: time all CPUs spent in hard interrupts
+ *	@softirq_ns	: time all CPUs spent in softirqs
+ *
+ *	irq_ns and softirq_ns come from kernel_cpustat, which is exact only
+ *	with CONFIG_IRQ_TIME_ACCOUNTING and is sampled at the tick otherwise;
+ *	they include the interrupt entry and exit that the callback cost
+ *	leaves out.
+ */
+struct hrt_result
+{
+	unsigned int mode;
+	u64 expiries;
+	u64 overruns;
+	u64 elapsed_ns;
+	u64 late_min_ns;
+	u64 late_mean_ns;
+	u64 late_p50_ns;
+	u64 late_p99_ns;
+	u64 late_p999_ns;
+	u64 late_max_ns;
+	u64 cb_mean_ns;
+	u64 irq_ns;
+	u64 softirq_ns;
+};
+
+static struct hrt_timer *timers;
 static ktime_t period_ns;
+static enum hrtimer_mode hrt_mode;
+static cpumask_var_t hrt_cpus;
+static bool have_cpus;
+
+/* the modes to run and the results of the finished ones */
+static unsigned int phase_mode[ARRAY_SIZE(hrt_modes)];
+static struct hrt_result results[ARRAY_SIZE(hrt_modes)];
+static unsigned int nr_phases, phase;
+
+/* timers still running, the last one to stop schedules the report */
+static atomic_t timers_running;
+static struct work_struct report_work;
+static bool reported, stopping;
+static u64 start_ns, end_ns;
+static u64 start_irq_ns, start_softirq_ns;
+
+/* the rings of all CPUs, in one vmalloc_user area for mmap */
+static void *ring_buf;
+static size_t ring_stride;
+static atomic_t ring_open;
+
+static dev_t ring_dev_num;
+static struct cdev ring_cdev;
+static struct class *ring_class;
+
+
+/*
+ *	struct hrt_hist - lateness of the expiries on one CPU
+ *
+ *	@buckets	: expiries per bucket, see hist_bucket
+ *	@count		: expiries recorded
+ *	@sum_ns		: sum of the lateness
+ *	@min_ns,@max_ns	: smallest and largest lateness
+ *
+ *	Lateness is the time from the programmed expiry to the start of the
+ *	callback. Only the timer callbacks of a CPU write its histogram and
+ *	they do not nest, so recording takes no lock; readers sum all CPUs and
+ *	may see a histogram that is being updated. The histograms are over
+ *	4 KiB per CPU, too large for the static per-CPU reserve of modules,
+ *	so they are allocated with alloc_percpu.
+ */
+struct hrt_hist
+{
+	u64 buckets[HIST_BUCKETS];
+	u64 count;
+	u64 sum_ns;
+	u64 min_ns;
+	u64 max_ns;
+};
+
+static struct hrt_hist __percpu *hrt_hist;
+static struct dentry *hrt_dir;
+
+
+/*
+ *	hist_bucket
+ *
+ *	Return Value:
+ *		- index of the bucket of "ns": "ns" itself below HIST_SUB,
+ *		  otherwise the power of two times HIST_SUB plus the next
+ *		  HIST_SUB_BITS bits below the leading one
+ */
+static unsigned int hist_bucket(u64 ns)
+{
+	unsigned int shift, idx;
+
+	if(ns < HIST_SUB)
+	{
+		return ns;
+	}
+
+	shift = fls64(ns) - HIST_SUB_BITS - 1;
+	idx = (shift + 1) * HIST_SUB + ((ns >> shift) & (HIST_SUB - 1));
+	return min_t(unsigned int, idx, HIST_BUCKETS - 1);
+}
+
+/* smallest lateness of bucket "idx" */
+static u64 hist_lower(unsigned int idx)
+{
+	if(idx < HIST_SUB)
+	{
+		return idx;
+	}
+	return (u64)(HIST_SUB + idx % HIST_SUB) << (idx / HIST_SUB - 1);
+}
+
+static void hist_record(u64 ns)
+{
+	struct hrt_hist *h = this_cpu_ptr(hrt_hist);
+
+	h->buckets[hist_bucket(ns)]++;
+	if(!h->count || ns < h->min_ns)
+	{
+		h->min_ns = ns;
+	}
+	if(ns > h->max_ns)
+	{
+		h->max_ns = ns;
+	}
+	h->sum_ns += ns;
+	h->count++;
+}
+
+
+/*
+ *	hist_sum
+ *
+ *	Details:
+ *		- adds the histograms of every possible CPU into "sum", which
+ *		  the caller zeroed
+ */
+static void hist_sum(struct hrt_hist *sum)
+{
+	unsigned int cpu, i;
+
+	for_each_possible_cpu(cpu)
+	{
+		struct hrt_hist *h = per_cpu_ptr(hrt_hist, cpu);
+
+		if(!h->count)
+		{
+			continue;
+		}
+		for(i = 0; i < HIST_BUCKETS; i++)
+		{
+			sum->buckets[i] += h->buckets[i];
+		}
+		if(!sum->count || h->min_ns < sum->min_ns)
+		{
+			sum->min_ns = h->min_ns;
+		}
+		sum->max_ns = max(sum->max_ns, h->max_ns);
+		sum->sum_ns += h->sum_ns;
+		sum->count += h->count;
+	}
+}
+
+
+/*
+ *	hist_percentile
+ *
+ *	Return Value:
+ *		- the lateness below which "per_10k" / 10000 of the expiries
+ *		  fall, as the upper end of its bucket (at most max_ns)
+ */
+static u64 hist_percentile(const struct hrt_hist *h, unsigned int per_10k)
+{
+	u64 target, seen = 0;
+	unsigned int i;
+
+	if(!h->count)
+	{
+		return 0;
+	}
+
+	target = div_u64(h->count * per_10k + 9999, 10000);
+	for(i = 0; i < HIST_BUCKETS - 1; i++)
+	{
+		seen += h->buckets[i];
+		if(seen >= target)
+		{
+			return min(hist_lower(i + 1) - 1, h->max_ns);
+		}
+	}
+	return h->max_ns;
+}
+
+
+/*
+ *	ring_put
+ *
+ *	Details:
+ *		- writes one sample to the ring of this CPU and publishes it
+ *		  with a release store of head; the callbacks of a CPU are the
+ *		  only producer of its ring
+ *		- counts the sample as dropped if the consumer has not freed
+ *		  a slot; size comes from ring_size, never from the mapping
+ *		  the consumer can write to
+ */
+static void ring_put(u64 now, unsigned int timer, u64 late, u64 cost)
+{
+	struct hrt_ring *r;
+	struct hrt_sample *sample;
+	u64 head;
+
+	if(!ring_buf)
+	{
+		return;
+	}
+
+	r = ring_buf + smp_processor_id() * ring_stride;
+	head = r->head;
+	if(head - smp_load_acquire(&r->tail) >= ring_size)
+	{
+		WRITE_ONCE(r->dropped, r->dropped + 1);
+		return;
+	}
+
+	sample = (struct hrt_sample *)((char *)r + PAGE_SIZE)
+			+ (head & (ring_size - 1));
+	sample->time_ns = now;
+	sample->late_ns = late;
+	sample->cb_ns = cost;
+	sample->cpu = smp_processor_id();
+	sample->timer = timer;
+	smp_store_release(&r->head, head + 1);
+}
 
 
 /*
  *  timer_callback_func - callback function for hrtimer
  *
  *	Details:
- *		- called when timer expires the first time
- *		- extends expiry time of timer by "period_ns"
+ *		- records how late the expiry is against the programmed expiry
+ *		  in the histogram of this CPU, and how long the callback takes
+ *		- extends expiry time of timer by "period_ns", counting the
+ *		  periods that were missed
+ *		- puts a sample in the ring of this CPU
+ *		- the last timer to stop schedules the report, after its
+ *		  statistics are written
+ *		- does not restart once "stopping" is set
  *
  *	Return Value:
  *		- HRTIMER_RESTART or HRTIMER_NORESTART
  */
 static enum hrtimer_restart timer_callback_func(struct hrtimer *timer)
-{	
-	static volatile int itr = 0;
-	ktime_t ktime_now;
+{
+	struct hrt_timer *t = container_of(timer, struct hrt_timer, timer);
+	u64 now = ktime_get_ns();
+	s64 late = now - ktime_to_ns(hrtimer_get_expires(timer));
+	bool restart = false;
+	u64 cost;
+
+	/* the module is being removed, do not arm again */
+	if(READ_ONCE(stopping))
+	{
+		return HRTIMER_NORESTART;
+	}
+
+	if(late < 0)
+	{
+		late = 0;
+	}
+	hist_record(late);
+
+	if(++t->itr < max_itr || !max_itr)
+	{
+		t->overruns += hrtimer_forward_now(timer, period_ns) - 1;
+		restart = true;
+	}
+
+	cost = ktime_get_ns() - now;
+	t->cost_sum_ns += cost;
+	t->cost_max_ns = max_t(u64, t->cost_max_ns, cost);
+	ring_put(now, t - timers, late, cost);
 
-	if(itr < MAX_ITR)
+	if(restart)
 	{
-		ktime_now = hrtimer_cb_get_time(timer);
-		hrtimer_forward(timer, ktime_now, period_ns);
-		printk(KERN_INFO "%2d \t %llu \t %lld\n", 
-			itr + 1, get_jiffies_64(), ktime_to_ns(ktime_now));
-		itr++;
 		return HRTIMER_RESTART;
 	}
-	else
-	{	
-		return HRTIMER_NORESTART;
+
+	if(atomic_dec_and_test(&timers_running))
+	{
+		end_ns = ktime_get_ns();
+		schedule_work(&report_work);
 	}
+	return HRTIMER_NORESTART;
 }
 
 
 /*
- *	hrt_mod_init - init function of module
+ *	cpustat_sum
+ *
+ *	Return Value:
+ *		- the "idx" (CPUTIME_IRQ, CPUTIME_SOFTIRQ) time of all CPUs in ns
+ */
+static u64 cpustat_sum(int idx)
+{
+	unsigned int cpu;
+	u64 sum = 0;
+
+	for_each_possible_cpu(cpu)
+	{
+		sum += kcpustat_cpu(cpu).cpustat[idx];
+	}
+	return sum;
+}
+
+
+/*
+ *	hrt_report
  *
  *	Details:
- *		- called when module loaded into kernel
- *		- initializes and starts timer
+ *		- sums the statistics of every timer and the histograms of
+ *		  every CPU into the result of the current mode, and prints it
+ *		  as one "key=value" line, the format scale.sh reads
+ */
+static void hrt_report(void)
+{
+	struct hrt_result *r = &results[phase];
+	u64 cost_sum = 0, cost_max = 0;
+	struct hrt_hist *h;
+	unsigned int i;
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if(!h)
+	{
+		printk(KERN_INFO "bad kzalloc\n");
+		return;
+	}
+	hist_sum(h);
+
+	memset(r, 0, sizeof(*r));
+	r->mode = phase_mode[phase];
+	for(i = 0; i < nr_timers; i++)
+	{
+		struct hrt_timer *t = &timers[i];
+
+		r->expiries += t->itr;
+		r->overruns += t->overruns;
+		cost_sum += t->cost_sum_ns;
+		cost_max = max(cost_max, t->cost_max_ns);
+	}
+
+	r->elapsed_ns = end_ns - start_ns;
+	r->late_min_ns = h->min_ns;
+	r->late_mean_ns = h->count ? div64_u64(h->sum_ns, h->count) : 0;
+	r->late_p50_ns = hist_percentile(h, 5000);
+	r->late_p99_ns = hist_percentile(h, 9900);
+	r->late_p999_ns = hist_percentile(h, 9990);
+	r->late_max_ns = h->max_ns;
+	r->cb_mean_ns = r->expiries ? div64_u64(cost_sum, r->expiries) : 0;
+	r->irq_ns = cpustat_sum(CPUTIME_IRQ) - start_irq_ns;
+	r->softirq_ns = cpustat_sum(CPUTIME_SOFTIRQ) - start_softirq_ns;
+
+	printk(KERN_INFO "hrt_mod: result mode=%s timers=%u period_us=%lu pinned=%d "
+		"expiries=%llu elapsed_ms=%llu overruns=%llu "
+		"late_mean_ns=%llu late_p99_ns=%llu late_max_ns=%llu "
+		"cb_mean_ns=%llu cb_max_ns=%llu irq_us=%llu softirq_us=%llu\n",
+		hrt_modes[r->mode].name, nr_timers, period_us,
+		!!(hrt_mode & HRTIMER_MODE_PINNED), r->expiries,
+		div_u64(r->elapsed_ns, NSEC_PER_MSEC), r->overruns,
+		r->late_mean_ns, r->late_p99_ns, r->late_max_ns,
+		r->cb_mean_ns, cost_max, div_u64(r->irq_ns, NSEC_PER_USEC),
+		div_u64(r->softirq_ns, NSEC_PER_USEC));
+	kfree(h);
+}
+
+
+/*
+ *	stats_show - read function of <debugfs>/hrt_mod/stats
  *
- * 	Note: The timer_callback_func is called when timer expires the first time		
+ *	Details:
+ *		- prints count, min, mean, max and p50/p99/p99.9 of the
+ *		  lateness of all CPUs, then count, min, mean and max of every
+ *		  CPU that recorded an expiry
  */
-static int __init hrt_mod_init(void)
-{	
-	const unsigned long per_ns = 1E9L;
+static int stats_show(struct seq_file *m, void *v)
+{
+	struct hrt_hist *h;
+	unsigned int cpu;
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if(!h)
+	{
+		return -ENOMEM;
+	}
+	hist_sum(h);
+
+	seq_printf(m, "count %llu\nmin_ns %llu\nmean_ns %llu\nmax_ns %llu\n",
+		h->count, h->min_ns,
+		h->count ? div64_u64(h->sum_ns, h->count) : 0, h->max_ns);
+	seq_printf(m, "p50_ns %llu\np99_ns %llu\np99.9_ns %llu\n",
+		hist_percentile(h, 5000), hist_percentile(h, 9900),
+		hist_percentile(h, 9990));
+
+	seq_puts(m, "\ncpu count min_ns mean_ns max_ns\n");
+	for_each_possible_cpu(cpu)
+	{
+		struct hrt_hist *c = per_cpu_ptr(hrt_hist, cpu);
 
-	printk(KERN_INFO "%s: HZ: %d, Timer period: %lu ns\n", __FUNCTION__, HZ, per_ns);
-	printk(KERN_INFO "itr# \t jiffies \t uptime_ns");
-	hrtimer_init(&my_hrt, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	my_hrt.function = &timer_callback_func;
-	period_ns = ktime_set(0, per_ns);
-	hrtimer_start(&my_hrt, period_ns, HRTIMER_MODE_REL);
+		if(c->count)
+		{
+			seq_printf(m, "%u %llu %llu %llu %llu\n", cpu, c->count,
+				c->min_ns, div64_u64(c->sum_ns, c->count), c->max_ns);
+		}
+	}
 
+	kfree(h);
 	return 0;
 }
-module_init(hrt_mod_init);
+DEFINE_SHOW_ATTRIBUTE(stats);
 
 
 /*
- *	hrt_mod_init - exit function of module
+ *	histogram_show - read function of <debugfs>/hrt_mod/histogram
  *
  *	Details:
- *		- called when module removed from kernel
- *		- waits for timer_callback_fun to complete whenever necessary
- *		- cancels hrtimer if timer is active/queued	
+ *		- prints "lower_ns upper_ns count" of every non empty bucket,
+ *		  summed over all CPUs
  */
-static void __exit hrt_mod_exit(void)
-{	
+static int histogram_show(struct seq_file *m, void *v)
+{
+	struct hrt_hist *h;
+	unsigned int i;
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if(!h)
+	{
+		return -ENOMEM;
+	}
+	hist_sum(h);
+
+	seq_puts(m, "lower_ns upper_ns count\n");
+	for(i = 0; i < HIST_BUCKETS; i++)
+	{
+		if(h->buckets[i])
+		{
+			seq_printf(m, "%llu %llu %llu\n", hist_lower(i),
+				i < HIST_BUCKETS - 1 ? hist_lower(i + 1) - 1 : h->max_ns,
+				h->buckets[i]);
+		}
+	}
+
+	kfree(h);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(histogram);
+
+/*
+ *	results_show - read function of <debugfs>/hrt_mod/results
+ *
+ *	Details:
+ *		- prints one row per finished mode, so the modes can be
+ *		  compared side by side
+ */
+static int results_show(struct seq_file *m, void *v)
+{
+	unsigned int i;
+
+	seq_printf(m, "%-12s %10s %8s %8s %8s %8s %8s %8s %10s %8s %10s %10s\n",
+		"mode", "expiries", "overruns", "min_ns", "mean_ns", "p50_ns",
+		"p99_ns", "p99.9_ns", "max_ns", "cb_ns", "irq_us", "softirq_us");
+	for(i = 0; i < phase + reported && i < nr_phases; i++)
+	{
+		struct hrt_result *r = &results[i];
+
+		seq_printf(m, "%-12s %10llu %8llu %8llu %8llu %8llu %8llu %8llu "
+			"%10llu %8llu %10llu %10llu\n",
+			hrt_modes[r->mode].name, r->expiries, r->overruns,
+			r->late_min_ns, r->late_mean_ns, r->late_p50_ns,
+			r->late_p99_ns, r->late_p999_ns, r->late_max_ns, r->cb_mean_ns,
+			div_u64(r->irq_ns, NSEC_PER_USEC),
+			div_u64(r->softirq_ns, NSEC_PER_USEC));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(results);
+
+
+/*
+ *	ring_dev_open - opens "hrt_ring", one consumer at a time
+ */
+static int ring_dev_open(struct inode *inode, struct file *filp)
+{
+	return atomic_cmpxchg(&ring_open, 0, 1) ? -EBUSY : 0;
+}
+
+static int ring_dev_release(struct inode *inode, struct file *filp)
+{
+	atomic_set(&ring_open, 0);
+	return 0;
+}
+
+
+/*
+ *	ring_dev_mmap - maps the rings of all CPUs
+ *
+ *	Details:
+ *		- the ring of CPU n starts at n * stride, its head in the
+ *		  first page and the samples after it
+ *		- the mapping must be shared and writable, the consumer
+ *		  stores the tail of every ring in it
+ */
+static int ring_dev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	if(!(vma->vm_flags & VM_SHARED))
+	{
+		return -EINVAL;
+	}
+	return remap_vmalloc_range(vma, ring_buf, vma->vm_pgoff);
+}
+
+
+/*
+ * file operations structure for the device
+ */
+static const struct file_operations ring_fops =
+{
+	.owner			= THIS_MODULE,
+	.open			= ring_dev_open,
+	.release		= ring_dev_release,
+	.mmap			= ring_dev_mmap,
+};
+
+
+/*
+ *	ring_init
+ *
+ *	Details:
+ *		- allocates one ring per possible CPU and fills in their heads
+ *		- creates the "hrt_ring" char device that maps them
+ *
+ *	Return Value:
+ *		- 0 on success, an error code otherwise
+ */
+static int ring_init(void)
+{
+	unsigned int cpu;
+	int ret;
+
+	ring_size = roundup_pow_of_two(ring_size);
+	ring_stride = PAGE_SIZE + PAGE_ALIGN(ring_size * sizeof(struct hrt_sample));
+
+	ring_buf = vmalloc_user(nr_cpu_ids * ring_stride);
+	if(!ring_buf)
+	{
+		printk(KERN_INFO "bad vmalloc_user\n");
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu)
+	{
+		struct hrt_ring *r = ring_buf + cpu * ring_stride;
+
+		r->size = ring_size;
+		r->nr_rings = nr_cpu_ids;
+		r->stride = ring_stride;
+		r->data = PAGE_SIZE;
+	}
+
+	/* allocate device numbers dynamically */
+	ret = alloc_chrdev_region(&ring_dev_num, 0, 1, DEVICE_NAME);
+	if(ret < 0)
+	{
+		printk(KERN_INFO "Cannot register char device numbers\n");
+		goto free_buf;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	ring_class = class_create(DRIVER_NAME);
+#else
+	ring_class = class_create(THIS_MODULE, DRIVER_NAME);
+#endif
+	if(IS_ERR(ring_class))
+	{
+		ret = PTR_ERR(ring_class);
+		goto free_num;
+	}
+
+	/* connect file operations with cdev */
+	cdev_init(&ring_cdev, &ring_fops);
+	ring_cdev.owner = THIS_MODULE;
+
+	ret = cdev_add(&ring_cdev, ring_dev_num, 1);
+	if(ret)
+	{
+		printk(KERN_INFO "Bad cdev\n");
+		goto free_class;
+	}
+
+	device_create(ring_class, NULL, ring_dev_num, NULL, "%s", DEVICE_NAME);
+	return 0;
+
+free_class:
+	class_destroy(ring_class);
+free_num:
+	unregister_chrdev_region(ring_dev_num, 1);
+free_buf:
+	vfree(ring_buf);
+	ring_buf = NULL;
+	return ret;
+}
+
+static void ring_free(void)
+{
+	if(!ring_buf)
+	{
+		return;
+	}
+
+	device_destroy(ring_class, ring_dev_num);
+	cdev_del(&ring_cdev);
+	class_destroy(ring_class);
+	unregister_chrdev_region(ring_dev_num, 1);
+	vfree(ring_buf);
+}
+
+
+/*
+ *	hrt_setup - hrtimer_init, or hrtimer_setup which replaces it
+ */
+static void hrt_setup(struct hrtimer *timer, enum hrtimer_mode mode)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(timer, timer_callback_func, CLOCK_MONOTONIC, mode);
+#else
+	hrtimer_init(timer, CLOCK_MONOTONIC, mode);
+	timer->function = &timer_callback_func;
+#endif
+}
+
+
+/*
+ *	start_timer
+ *
+ *	Details:
+ *		- arms one timer, its first expiry is one period away or, with
+ *		  "spread", its share of the period
+ *		- a pinned timer is started through smp_call_function_single on
+ *		  its CPU, since a pinned hrtimer stays on the CPU it was
+ *		  started on
+ */
+static void start_timer(void *info)
+{
+	struct hrt_timer *t = info;
+	ktime_t first = period_ns;
+
+	if(spread)
+	{
+		first = ns_to_ktime(div_u64((u64)ktime_to_ns(period_ns)
+				* ((t - timers) + 1), nr_timers));
+	}
+	hrtimer_start(&t->timer, first, hrt_mode);
+}
+
+
+/*
+ *	parse_cpus
+ *
+ *	Details:
+ *		- parses the "cpus" list into mask, keeping online CPUs only
+ *
+ *	Return Value:
+ *		- 0 on success, -EINVAL on a bad or offline-only list
+ */
+static int parse_cpus(struct cpumask *mask)
+{
+	if(cpulist_parse(cpus, mask) < 0)
+	{
+		return -EINVAL;
+	}
+
+	cpumask_and(mask, mask, cpu_online_mask);
+	return cpumask_empty(mask) ? -EINVAL : 0;
+}
+
+
+/*
+ *	parse_modes
+ *
+ *	Details:
+ *		- fills phase_mode from the comma separated "modes" list
+ *		- without "modes" the one mode is "rel", or "pinned" when
+ *		  "cpus" is set
+ *		- a pinned mode without "cpus" pins to all online CPUs
+ *
+ *	Return Value:
+ *		- 0 on success, -EINVAL on an unknown mode or too many modes
+ */
+static int parse_modes(void)
+{
+	char *list, *pos, *name;
+	unsigned int i;
+	int ret = 0;
+
+	if(!modes || !*modes)
+	{
+		phase_mode[nr_phases++] = have_cpus ? MODE_PINNED : MODE_REL;
+		return 0;
+	}
+
+	list = kstrdup(modes, GFP_KERNEL);
+	if(!list)
+	{
+		return -ENOMEM;
+	}
+
+	pos = list;
+	while((name = strsep(&pos, ",")) != NULL)
+	{
+		if(!*name)
+		{
+			continue;
+		}
+		for(i = 0; i < ARRAY_SIZE(hrt_modes); i++)
+		{
+			if(!strcmp(name, hrt_modes[i].name))
+			{
+				break;
+			}
+		}
+		if(i == ARRAY_SIZE(hrt_modes) || nr_phases == ARRAY_SIZE(phase_mode))
+		{
+			ret = -EINVAL;
+			break;
+		}
+		phase_mode[nr_phases++] = i;
+
+		if((hrt_modes[i].mode & HRTIMER_MODE_PINNED) && !have_cpus)
+		{
+			cpumask_copy(hrt_cpus, cpu_online_mask);
+			have_cpus = true;
+		}
+	}
+	kfree(list);
+
+	return ret ? ret : (nr_phases ? 0 : -EINVAL);
+}
+
+
+/*
+ *	start_phase
+ *
+ *	Details:
+ *		- clears the statistics and starts every timer in the mode of
+ *		  the current phase
+ *		- with a CPU list the timers are started round robin on its
+ *		  CPUs; they stay there if the mode is pinned
+ */
+static void start_phase(void)
+{
+	unsigned int i, cpu;
+	int next = -1;
+
+	hrt_mode = hrt_modes[phase_mode[phase]].mode;
+	for_each_possible_cpu(cpu)
+	{
+		memset(per_cpu_ptr(hrt_hist, cpu), 0, sizeof(struct hrt_hist));
+	}
+
+	printk(KERN_INFO "%s: mode %s, %u timers, period: %lld ns\n", __FUNCTION__,
+		hrt_modes[phase_mode[phase]].name, nr_timers, ktime_to_ns(period_ns));
+
+	atomic_set(&timers_running, nr_timers);
+	start_irq_ns = cpustat_sum(CPUTIME_IRQ);
+	start_softirq_ns = cpustat_sum(CPUTIME_SOFTIRQ);
+
+	cpus_read_lock();
+	start_ns = ktime_get_ns();
+	for(i = 0; i < nr_timers; i++)
+	{
+		struct hrt_timer *t = &timers[i];
+
+		t->cpu = -1;
+		t->itr = 0;
+		t->overruns = 0;
+		t->cost_sum_ns = 0;
+		t->cost_max_ns = 0;
+		hrt_setup(&t->timer, hrt_mode);
+
+		if(have_cpus)
+		{
+			next = cpumask_next(next, hrt_cpus);
+			if(next >= nr_cpu_ids)
+			{
+				next = cpumask_first(hrt_cpus);
+			}
+		}
+		if(have_cpus && cpu_online(next))
+		{
+			t->cpu = next;
+			smp_call_function_single(next, start_timer, t, 1);
+		}
+		else
+		{
+			start_timer(t);
+		}
+	}
+	cpus_read_unlock();
+}
+
+
+/*
+ *	report_work_func
+ *
+ *	Details:
+ *		- scheduled when the last timer of a mode stops
+ *		- reports the mode and starts the timers again in the next
+ *		  one, after hrtimer_cancel has waited for the callbacks that
+ *		  are still returning
+ */
+static void report_work_func(struct work_struct *work)
+{
+	unsigned int i;
+
+	if(READ_ONCE(stopping))
+	{
+		return;
+	}
+
+	hrt_report();
+	if(phase + 1 == nr_phases)
+	{
+		reported = true;
+		return;
+	}
+
+	for(i = 0; i < nr_timers; i++)
+	{
+		hrtimer_cancel(&timers[i].timer);
+	}
+	phase++;
+	start_phase();
+}
+
+
+/*
+ *	hrt_mod_init - init function of module
+ *
+ *	Details:
+ *		- called when module loaded into kernel
+ *		- checks the parameters, allocates nr_timers timers and starts
+ *		  them in the first mode; the others follow from
+ *		  report_work_func
+ *		- creates the "hrt_ring" device with a ring of samples per CPU,
+ *		  unless ring_size is 0
+ *		- creates <debugfs>/hrt_mod with the "stats" and "histogram"
+ *		  files of the lateness and the "results" of every mode
+ *
+ * 	Note: The timer_callback_func is called when timer expires the first time
+ */
+static int __init hrt_mod_init(void)
+{
 	int ret = 0;
-	while(hrtimer_callback_running(&my_hrt))
+
+	if(nr_timers < 1 || nr_timers > HRT_MAX_TIMERS || period_us == 0
+			|| ring_size > HRT_MAX_RING_SIZE)
+	{
+		printk(KERN_INFO "%s: invalid parameters\n", __FUNCTION__);
+		return -EINVAL;
+	}
+
+	if(!zalloc_cpumask_var(&hrt_cpus, GFP_KERNEL))
 	{
-		ret++;
+		return -ENOMEM;
 	}
 
+	if(cpus && *cpus)
+	{
+		ret = parse_cpus(hrt_cpus);
+		if(ret)
+		{
+			printk(KERN_INFO "%s: invalid cpus \"%s\"\n", __FUNCTION__, cpus);
+			goto free_mask;
+		}
+		have_cpus = true;
+	}
+
+	ret = parse_modes();
 	if(ret)
 	{
-		printk(KERN_INFO "Waited for hrtimer callback to complete (%d)\n", ret);
+		printk(KERN_INFO "%s: invalid modes \"%s\"\n", __FUNCTION__, modes);
+		goto free_mask;
 	}
 
-	if(hrtimer_active(&my_hrt) != 0)
+	hrt_hist = alloc_percpu(struct hrt_hist);
+	if(!hrt_hist)
+	{
+		ret = -ENOMEM;
+		goto free_mask;
+	}
+
+	timers = kvcalloc(nr_timers, sizeof(*timers), GFP_KERNEL);
+	if(!timers)
+	{
+		printk(KERN_INFO "bad kvcalloc\n");
+		ret = -ENOMEM;
+		goto free_hist;
+	}
+
+	if(ring_size)
+	{
+		ret = ring_init();
+		if(ret)
+		{
+			kvfree(timers);
+			goto free_hist;
+		}
+	}
+
+	period_ns = ns_to_ktime((u64)period_us * NSEC_PER_USEC);
+	printk(KERN_INFO "%s: HZ: %d, %u modes\n", __FUNCTION__, HZ, nr_phases);
+
+	hrt_dir = debugfs_create_dir("hrt_mod", NULL);
+	debugfs_create_file("stats", 0444, hrt_dir, NULL, &stats_fops);
+	debugfs_create_file("histogram", 0444, hrt_dir, NULL, &histogram_fops);
+	debugfs_create_file("results", 0444, hrt_dir, NULL, &results_fops);
+
+	INIT_WORK(&report_work, report_work_func);
+	start_phase();
+	return 0;
+
+free_hist:
+	free_percpu(hrt_hist);
+free_mask:
+	free_cpumask_var(hrt_cpus);
+	return ret;
+}
+module_init(hrt_mod_init);
+
+
+/*
+ *	hrt_mod_exit - exit function of module
+ *
+ *	Details:
+ *		- called when module removed from kernel
+ *		- sets "stopping" first: a callback that runs from then on does
+ *		  not arm its timer again, and report_work_func does not start
+ *		  another mode
+ *		- then every timer is cancelled once; hrtimer_cancel dequeues a
+ *		  pending timer or waits for its running callback, which will
+ *		  not restart it, so each cancel waits for one callback at most
+ *		- reports a mode that did not finish yet, and how long stopping
+ *		  the timers and the whole unload took
+ */
+static void __exit hrt_mod_exit(void)
+{
+	u64 unload_ns = ktime_get_ns(), stop_ns;
+	unsigned int i, armed = 0;
+
+	WRITE_ONCE(stopping, true);
+	debugfs_remove_recursive(hrt_dir);
+
+	cancel_work_sync(&report_work);
+	for(i = 0; i < nr_timers; i++)
 	{
-		ret = hrtimer_cancel(&my_hrt);
-		printk(KERN_INFO "hrtimer cancelled (%d)\n", ret);
+		armed += hrtimer_cancel(&timers[i].timer);
 	}
+	cancel_work_sync(&report_work);
+	stop_ns = ktime_get_ns() - unload_ns;
 
-	if(hrtimer_is_queued(&my_hrt) != 0)
+	if(!reported)
 	{
-		ret = hrtimer_cancel(&my_hrt);
-		printk(KERN_INFO "hrtimer cancelled (%d)\n", ret);
+		end_ns = ktime_get_ns();
+		hrt_report();
 	}
+	ring_free();
+	kvfree(timers);
+	free_percpu(hrt_hist);
+	free_cpumask_var(hrt_cpus);
 
+	printk(KERN_INFO "hrt_mod: unload timers=%u armed=%u stop_us=%llu "
+		"unload_us=%llu\n", nr_timers, armed,
+		div_u64(stop_ns, NSEC_PER_USEC),
+		div_u64(ktime_get_ns() - unload_ns, NSEC_PER_USEC));
 	printk(KERN_INFO "%s: removing hrt_mod\n", __FUNCTION__);
 }
 module_exit(hrt_mod_exit);
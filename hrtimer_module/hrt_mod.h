@@ -0,0 +1,82 @@
+/*
+ *	hrt_mod.h
+ *
+ *	Definitions for the hrtimer module, and the layout of the sample
+ *	rings shared with hrt_consumer
+ */
+
+#ifndef _HRT_MOD_H_
+#define _HRT_MOD_H_
+
+#include <linux/types.h>
+
+/* default number of expiries of every timer */
+#define MAX_ITR 15
+
+/* range of the nr_timers parameter */
+#define HRT_MAX_TIMERS 10000
+
+/* default timer period, 1 s */
+#define HRT_DEFAULT_PERIOD_US 1000000
+
+/*
+ *	lateness histogram: values below HIST_SUB ns get one bucket each, every
+ *	power of two above is split into HIST_SUB linear buckets (6% wide),
+ *	the last bucket takes everything from 31 * 2^30 ns (33 s) up
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS 512
+
+#define DEVICE_NAME "hrt_ring"
+#define DRIVER_NAME "hrt_ring_driver"
+
+/* default and largest samples of every ring */
+#define HRT_RING_SIZE 16384
+#define HRT_MAX_RING_SIZE (1 << 24)
+
+/*
+ *	struct hrt_sample - one expiry
+ *
+ *	@time_ns	: ktime_get_ns at the start of the callback
+ *	@late_ns	: time from the programmed expiry to time_ns
+ *	@cb_ns		: time spent in the callback
+ *	@cpu		: CPU of the callback
+ *	@timer		: index of the timer
+ */
+struct hrt_sample
+{
+	__u64 time_ns;
+	__u64 late_ns;
+	__u64 cb_ns;
+	__u32 cpu;
+	__u32 timer;
+};
+
+/*
+ *	struct hrt_ring - head of the ring of one CPU
+ *
+ *	@head		: samples written, by the callbacks of the CPU only
+ *	@dropped	: samples lost because the ring was full
+ *	@size		: samples in the ring, a power of two
+ *	@nr_rings	: rings in the device, one per possible CPU
+ *	@stride		: bytes from one ring to the next
+ *	@data		: offset of sample 0 from the head
+ *	@tail		: samples read, by the consumer only
+ *
+ *	Sample n is at data + (n & (size - 1)). The kernel publishes a sample
+ *	by a release store of head, the consumer frees it by a release store
+ *	of tail; tail is on its own cache line.
+ */
+struct hrt_ring
+{
+	__u64 head;
+	__u64 dropped;
+	__u32 size;
+	__u32 nr_rings;
+	__u64 stride;
+	__u64 data;
+	__u64 tail __attribute__((aligned(64)));
+};
+
+#endif /* _HRT_MOD_H_ */
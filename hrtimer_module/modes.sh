@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+#	modes.sh
+#
+#	Runs the same timers in every hrtimer mode back to back and prints
+#	the lateness and CPU cost of the modes side by side, from
+#	<debugfs>/hrt_mod/results. Run as root after "make", with debugfs
+#	mounted.
+#
+#	usage: ./modes.sh [nr_timers] [period_us] [max_itr] [cpus] [modes]
+#
+#	e.g.   ./modes.sh 100 1000 1000 2 rel,soft,hard,pinned_soft,pinned_hard
+#
+
+TIMERS=${1:-100}
+PERIOD=${2:-1000}
+ITR=${3:-1000}
+CPUS=${4:-}
+MODES=${5:-rel,soft,hard,pinned,pinned_soft,pinned_hard}
+RESULTS=/sys/kernel/debug/hrt_mod/results
+
+N=$(echo "$MODES" | tr ',' '\n' | grep -c .)
+
+# seconds one mode takes, the wait gives every mode twice that
+SECS=$(( PERIOD * ITR / 1000000 + 1 ))
+LIMIT=$(( SECS * N * 2 + 5 ))
+
+insmod ./hrt_mod.ko nr_timers=$TIMERS period_us=$PERIOD max_itr=$ITR \
+	modes=$MODES ${CPUS:+cpus=$CPUS} || exit 1
+
+# the header and one row per finished mode
+while [ $(wc -l < $RESULTS) -le $N ] && [ $LIMIT -gt 0 ]
+do
+	sleep 1
+	LIMIT=$(( LIMIT - 1 ))
+done
+
+cat $RESULTS
+rmmod hrt_mod
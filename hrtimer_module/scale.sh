@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+#	scale.sh
+#
+#	Loads hrt_mod.ko once for every timer count and prints how the
+#	lateness of the expiries, the cost of the callback and the time to
+#	unload grow with the number of timers. Run as root after "make".
+#	With max_itr 0 the timers run until rmmod, so the unload stops all
+#	of them while they are armed.
+#
+#	usage: ./scale.sh [period_us] [max_itr] [cpus] [counts...]
+#
+#	e.g.   ./scale.sh 100 1000 0-3 1 10 100 1000 10000
+#
+
+PERIOD=${1:-1000}
+ITR=${2:-100}
+CPUS=${3:-}
+if [ $# -ge 3 ]; then shift 3; else set --; fi
+COUNTS=${*:-1 10 100 1000 10000}
+
+# seconds one run takes, plus one for loading and the report; with
+# max_itr 0 every count runs for one second
+SECS=$(( PERIOD * ITR / 1000000 + 1 ))
+
+printf '%8s %10s %10s %12s %12s %12s %10s %10s %10s\n' timers expiries \
+	overruns late_mean_ns late_p99_ns late_max_ns cb_mean_ns cb_max_ns \
+	unload_us
+
+for n in $COUNTS
+do
+	if ! insmod ./hrt_mod.ko nr_timers=$n period_us=$PERIOD max_itr=$ITR \
+		${CPUS:+cpus=$CPUS}
+	then
+		exit 1
+	fi
+	sleep $SECS
+	rmmod hrt_mod
+
+	# rmmod prints the result of a run that did not finish, then the
+	# unload line, so the last two lines are always the ones of this run
+	dmesg | grep -E 'hrt_mod: (result|unload)' | tail -n 2 | tr ' ' '\n' |
+	awk -F= '
+		{ v[$1] = $2 }
+		END {
+			printf "%8s %10s %10s %12s %12s %12s %10s %10s %10s\n",
+				v["timers"], v["expiries"], v["overruns"],
+				v["late_mean_ns"], v["late_p99_ns"], v["late_max_ns"],
+				v["cb_mean_ns"], v["cb_max_ns"], v["unload_us"]
+		}'
+done
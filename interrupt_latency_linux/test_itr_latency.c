@@ -6,130 +6,274 @@
 #include <linux/errno.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
+#include <linux/irq_work.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
 #include <linux/slab.h>	
 #include <linux/delay.h>
+#include <linux/moduleparam.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+#include <linux/sched/clock.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/cpu.h>
+#include <linux/topology.h>
+#include <linux/version.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+#include <linux/sched/types.h>
+#include <linux/sizes.h>
+#include <linux/gfp.h>
 
 #include "test_itr_latency.h"
 
+static char *backend = "gpio";
+module_param(backend, charp, 0444);
+MODULE_PARM_DESC(backend, "interrupt source: gpio (GPIO2 wired to GPIO3), irq_work (self IPI) or ipi (IPI to ipi_cpu)");
+
+static int ipi_cpu = -1;
+module_param(ipi_cpu, int, 0444);
+MODULE_PARM_DESC(ipi_cpu, "CPU the ipi backend interrupts (default: the first other online CPU)");
+
+static unsigned int cycles = TOTAL_CYCLES;
+module_param(cycles, uint, 0444);
+MODULE_PARM_DESC(cycles, "number of interrupts to measure");
+
+static char *clock_name = "ktime";
+module_param_named(clock, clock_name, charp, 0444);
+MODULE_PARM_DESC(clock, "ktime (ktime_get_ns, comparable across CPUs) or local (local_clock, cheaper, for a handler on the triggering CPU)");
+
+static bool sweep;
+module_param(sweep, bool, 0444);
+MODULE_PARM_DESC(sweep, "steer the interrupt to every online CPU in turn and print a per-CPU table");
+
+static char *cpus;
+module_param(cpus, charp, 0444);
+MODULE_PARM_DESC(cpus, "CPU list (e.g. 0-3,8) to sweep instead of all online CPUs, implies sweep");
+
+static char *bh_names = "hardirq";
+module_param_named(bh, bh_names, charp, 0444);
+MODULE_PARM_DESC(bh, "bottom halves to measure back to back: hardirq, threaded, tasklet, workqueue, wq_highpri, wq_unbound, fifo, or all");
+
+static bool stress;
+module_param(stress, bool, 0444);
+MODULE_PARM_DESC(stress, "same as load=cpu");
+
+static char *load_names;
+module_param_named(load, load_names, charp, 0444);
+MODULE_PARM_DESC(load, "load generators to measure every bottom half again under: cpu, nopreempt, membw, alloc (comma separated)");
+
+static char *load_cpus;
+module_param(load_cpus, charp, 0444);
+MODULE_PARM_DESC(load_cpus, "CPU list the load threads run on (default: all online CPUs)");
+
+static unsigned int load_window_us = LOAD_WINDOW_US;
+module_param(load_window_us, uint, 0444);
+MODULE_PARM_DESC(load_window_us, "time a nopreempt thread spins with preemption disabled");
+
+static unsigned int load_mem_kb = LOAD_MEM_KB;
+module_param(load_mem_kb, uint, 0444);
+MODULE_PARM_DESC(load_mem_kb, "buffer every membw thread copies, in KiB");
+
+static unsigned int timeout_us = HANDLER_TIMEOUT_US;
+module_param(timeout_us, uint, 0444);
+MODULE_PARM_DESC(timeout_us, "time a cycle waits for the bottom half before counting it missed");
+
+/* CPU the cycles are triggered from, -1 for the CPU init runs on */
+static int trigger_cpu = -1;
+
+
+/*
+ *	struct latency_stats - the result of one run of 'cycles' cycles
+ *
+ *	@ret		: error steering the interrupt, the rest is unset if not 0
+ *	@n		: cycles handled
+ *	@missed		: cycles missed
+ *	@min,@avg,@p50,@p99,@p9999,@max : latency in ns
+ */
+struct latency_stats
+{
+	int ret;
+	u32 n;
+	u32 missed;
+	u32 min;
+	u64 avg;
+	u32 p50;
+	u32 p99;
+	u32 p9999;
+	u32 max;
+};
+
 
 /*
  *	struct itr_latency_data
  *
- *	@handler_time	: stores start time of ISR execution
- *	@trigger_time	: stores time right before square wave generation
+ *	@handler_ns	: stores start time of ISR execution
+ *	@seq		: number of the cycle being measured, never 0
+ *	@irq_seq	: seq when the interrupt handler ran
+ *	@handled	: irq_seq of the bottom half that stored handler_ns,
+ *			  0 before any did
+ *	@now		: the clock both timestamps are taken with
+ *	@counts		: handled cycles per latency bucket (lat_bucket),
+ *			  preallocated
+ *	@nr_samples	: cycles handled
+ *	@sum_ns,@min_ns,@max_ns : sum and range of their latency
  *	@irq 		: irq line number
  *	@missed_int	: counter for missed interrupts
+ *	@work		: irq_work raised by the irq_work backend
+ *	@done		: completed by a bottom half that runs in a thread
+ *	@bh_irq		: dummy irq whose thread is the "threaded" bottom half
+ *	@bh_tasklet,@bh_work,@bh_task : the other bottom halves
+ *	@bh_pending	: raised before waking bh_task, dropped by it after
+ *			  bh_record
  */
 struct itr_latency_data
 {
-	struct timespec handler_time;
-	struct timespec trigger_time;
+	u64 handler_ns;
+	u32 seq;
+	u32 irq_seq;
+	u32 handled;
+	u64 (*now)(void);
+	u32 *counts;
+	u32 nr_samples;
+	u64 sum_ns;
+	u32 min_ns;
+	u32 max_ns;
 	u16 irq;
-	u8  missed_int;
+	u32 missed_int;
+	struct irq_work work;
+	struct completion done;
+	int bh_irq;
+	struct tasklet_struct bh_tasklet;
+	struct work_struct bh_work;
+	struct task_struct *bh_task;
+	atomic_t bh_pending;
 }
 *data_ptr;
 
 
 /*
- *	interrupt handler
+ *	struct bh_path - a bottom half the interrupt defers to
  *
- *	Details:
- *		- called when a rising edge at GPIO3 generates an interrupt signal
- *		- timestamps start time of handler execution
- *		- returns IRQ_HANDLED
+ *	@name		: value of the "bh" parameter
+ *	@setup		: prepares the bottom half, returns 0 on success
+ *	@fire		: called by the interrupt handler to defer to it, NULL
+ *			  for the handler itself
+ *	@release	: waits for it to finish and frees it
+ *	@sync		: waits for a fired bottom half to finish, NULL if
+ *			  it runs within the interrupt handler
+ *	@sleeps		: the bottom half is a thread, which may need the CPU
+ *			  the cycles run on, so the cycles sleep on "done"
+ *			  instead of polling
  */
-static irqreturn_t
-interrupt_handler(int irq, void *dev_id)
-{	
-	static int count = 1;
-	getnstimeofday(&data_ptr->handler_time);
-	printk("\t interrupt handled, count: %d\n", count);
-	count++;
-	return IRQ_HANDLED;
-}
+struct bh_path
+{
+	const char *name;
+	int (*setup)(void);
+	void (*fire)(void);
+	void (*release)(void);
+	void (*sync)(void);
+	bool sleeps;
+};
+
+/* the bottom half being measured, and the load it runs under */
+static const struct bh_path *bh;
+static const char *load_name = "none";
 
 
 /*
- *	measure_interrupt_latency
+ *	struct itr_backend - an interrupt source
+ *
+ *	@name		: value of the "backend" parameter
+ *	@setup		: claims the source and registers its handler, returns 0
+ *			  on success, error otherwise
+ *	@trigger	: raises one interrupt
+ *	@release	: frees what setup claimed
+ *	@steer		: makes the handler run on a CPU, setting trigger_cpu if
+ *			  the cycles must run elsewhere; returns 0 on success
+ *	@sync		: waits for a raised interrupt to be handled
+ */
+struct itr_backend
+{
+	const char *name;
+	int (*setup)(void);
+	void (*trigger)(void);
+	void (*release)(void);
+	int (*steer)(int cpu);
+	void (*sync)(void);
+};
+
+
+/*
+ *	bh_record
  *
  *	Details:
- *		- called by latency_module_init function
- *		- generates 'TOTAL_CYCLES' square wave cycles at GPIO2
- *		- timestamps time right before a high pulse is generated at GPIO2
- *		- calculates and prints interrupt latency to kernel log
+ *		- called first thing by the bottom half being measured
+ *		- timestamps start time of its execution, nothing else:
+ *		  no printk while measuring
+ *		- tags it with the cycle of the interrupt that fired it, so
+ *		  the cycles ignore a bottom half of an earlier cycle
  */
 static void
-measure_itr_latency(void)
+bh_record(void)
 {
-	int i = 0;
-	for(i = 0; i < TOTAL_CYCLES; i++)
+	data_ptr->handler_ns = data_ptr->now();
+	smp_store_release(&data_ptr->handled, READ_ONCE(data_ptr->irq_seq));
+	if(bh->sleeps)
 	{
-		printk(KERN_INFO "triggering cycle: %d\n", i + 1);
-		getnstimeofday(&data_ptr->trigger_time);
-
-		gpio_set_value(GPIO2, 1);
-		udelay(50);
-		gpio_set_value(GPIO2, 0);
-		udelay(50);
-
-		if(data_ptr->handler_time.tv_nsec == 0)
-		{
-			data_ptr->missed_int++;
-			printk(KERN_INFO "\t interrupt missed, missed count: %d\n\n",
-				data_ptr->missed_int);
-		}
-		else
-		{
-			printk(KERN_INFO "\t latency %lu ns\n\n",
-				(data_ptr->handler_time.tv_nsec) - (data_ptr->trigger_time.tv_nsec));
-			data_ptr->handler_time.tv_nsec = 0;
-			data_ptr->trigger_time.tv_nsec = 0;
-		}
+		complete(&data_ptr->done);
 	}
 }
 
 
 /*
- *	free_resources
+ *	handle_interrupt
  *
  *	Details:
- *		- called by latency_module_init function
- *		- frees gpio pins and irq line requested by latency_module_init
- *		- returns 0 on success
+ *		- called first thing by the handler of every backend
+ *		- records the time itself for the "hardirq" bottom half, or
+ *		  defers to the bottom half being measured
  */
 static void
-free_resources(void)
+handle_interrupt(void)
 {
-	kfree(data_ptr);
-	free_irq(data_ptr->irq, data_ptr);
-	gpio_free(GPIO2);
-	gpio_free(GPIO3);
-	gpio_free(GPIO2_LEV);
-	gpio_free(GPIO3_LEV);
+	WRITE_ONCE(data_ptr->irq_seq, READ_ONCE(data_ptr->seq));
+	if(bh->fire)
+	{
+		bh->fire();
+	}
+	else
+	{
+		bh_record();
+	}
 }
 
+
 /*
- *	latency_module_init
+ *	interrupt handler
  *
  *	Details:
- *		- requests required gpio pins
- *		- requests irq line and registers interrupt_handler
- *		- calls helper functions
- *		- returns 0 on success, error otherwise
+ *		- called when a rising edge at GPIO3 generates an interrupt signal
+ *		- returns IRQ_HANDLED
  */
-static int 
-__init latency_module_init(void)
+static irqreturn_t
+interrupt_handler(int irq, void *dev_id)
+{	
+	handle_interrupt();
+	return IRQ_HANDLED;
+}
+
+static int
+gpio_setup(void)
 {
 	int ret = 0, irq_line = 0;
 
-	/* allocate memory for the hcsr04_dev structure */
-	data_ptr = kzalloc(sizeof(struct itr_latency_data), GFP_KERNEL);
-	if(!data_ptr)
-	{
-		printk(KERN_INFO "bad kzalloc\n");
-		return -ENOMEM;
-	}
-
 	gpio_free(GPIO2);
 	gpio_free(GPIO3);
 	gpio_free(GPIO2_LEV);
@@ -153,7 +297,7 @@ __init latency_module_init(void)
 	if(irq_line < 0)
 	{
 		printk(KERN_INFO "gpio%d cannot be used as interrupt", GPIO3);
-		return EINVAL;
+		return -EINVAL;
 	}
 
 	data_ptr->irq = irq_line;
@@ -167,16 +311,1272 @@ __init latency_module_init(void)
 	if(ret)
 	{
 		printk(KERN_INFO "unable to claim irq %d\n", irq_line);
-		return ret;
 	}
+	return ret;
+}
 
-	printk(KERN_INFO "%s: module loaded\n", __FUNCTION__);
+/* one square wave cycle at GPIO2 */
+static void
+gpio_trigger(void)
+{
+	gpio_set_value(GPIO2, 1);
+	udelay(50);
+	gpio_set_value(GPIO2, 0);
+	udelay(50);
+}
 
-	measure_itr_latency();
-	free_resources();
-	
+static void
+gpio_release(void)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 14, 0)
+	irq_set_affinity_hint(data_ptr->irq, NULL);
+#endif
+	free_irq(data_ptr->irq, data_ptr);
+	gpio_free(GPIO2);
+	gpio_free(GPIO3);
+	gpio_free(GPIO2_LEV);
+	gpio_free(GPIO3_LEV);
+}
+
+static void
+gpio_sync(void)
+{
+	synchronize_irq(data_ptr->irq);
+}
+
+/*
+ *	gpio_steer
+ *
+ *	Details:
+ *		- routes the GPIO irq line to "cpu"; before 5.14 setting the
+ *		  affinity hint also set the affinity, irq_set_affinity is
+ *		  exported from 5.14 on
+ */
+static int
+gpio_steer(int cpu)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+	return irq_set_affinity(data_ptr->irq, cpumask_of(cpu));
+#else
+	return irq_set_affinity_hint(data_ptr->irq, cpumask_of(cpu));
+#endif
+}
+
+
+/*
+ *	irq_work handler
+ *
+ *	Details:
+ *		- runs in hard interrupt context, from the self IPI that
+ *		  irq_work_queue sends to the local CPU
+ */
+static void
+irq_work_handler(struct irq_work *work)
+{
+	handle_interrupt();
+}
+
+static int
+irq_work_setup(void)
+{
+	/* without an interrupt to raise, irq_work runs at the next tick */
+	if(!arch_irq_work_has_interrupt())
+	{
+		printk(KERN_INFO "irq_work has no interrupt on this architecture\n");
+		return -ENODEV;
+	}
+
+#ifdef IRQ_WORK_INIT_HARD
+	/* run in hard interrupt context on PREEMPT_RT too */
+	data_ptr->work = IRQ_WORK_INIT_HARD(irq_work_handler);
+#else
+	init_irq_work(&data_ptr->work, irq_work_handler);
+#endif
+	return 0;
+}
+
+static void
+irq_work_trigger(void)
+{
+	irq_work_queue(&data_ptr->work);
+}
+
+/* also the sync of the backend */
+static void
+irq_work_release(void)
+{
+	irq_work_sync(&data_ptr->work);
+}
+
+/* the self IPI interrupts the CPU that queues the work */
+static int
+irq_work_steer(int cpu)
+{
+	trigger_cpu = cpu;
+	return 0;
+}
+
+
+/* IPIs sent and not handled yet */
+static atomic_t ipi_inflight = ATOMIC_INIT(0);
+
+/*
+ *	ipi handler
+ *
+ *	Details:
+ *		- runs in the function call IPI on ipi_cpu
+ *		- drops ipi_inflight last, after it is done with data_ptr
+ */
+static void
+ipi_handler(void *info)
+{
+	handle_interrupt();
+	atomic_dec(&ipi_inflight);
+}
+
+/*
+ *	ipi_setup
+ *
+ *	Details:
+ *		- a function call to the CPU we run on is a plain call, not an
+ *		  interrupt, so the cycles are triggered from another online
+ *		  CPU than ipi_cpu
+ */
+static int
+ipi_setup(void)
+{
+	if(ipi_cpu < 0)
+	{
+		ipi_cpu = cpumask_next(cpumask_first(cpu_online_mask), cpu_online_mask);
+	}
+	if(ipi_cpu >= nr_cpu_ids || !cpu_online(ipi_cpu))
+	{
+		printk(KERN_INFO "ipi backend needs a second online CPU\n");
+		return -ENODEV;
+	}
+
+	trigger_cpu = cpumask_any_but(cpu_online_mask, ipi_cpu);
+	printk(KERN_INFO "ipi backend interrupts cpu %d from cpu %d\n",
+		ipi_cpu, trigger_cpu);
+	return 0;
+}
+
+/* sends the IPI without waiting for the handler */
+static void
+ipi_trigger(void)
+{
+	atomic_inc(&ipi_inflight);
+	if(smp_call_function_single(ipi_cpu, ipi_handler, NULL, 0))
+	{
+		atomic_dec(&ipi_inflight);
+	}
+}
+
+/*
+ *	ipi_release
+ *
+ *	Details:
+ *		- the IPI of a cycle that timed out may still be pending, and
+ *		  its handler uses data_ptr; waits until every IPI sent ran
+ *		- also the sync of the backend
+ */
+static void
+ipi_release(void)
+{
+	while(atomic_read(&ipi_inflight))
+	{
+		usleep_range(10, 20);
+	}
+}
+
+static int
+ipi_steer(int cpu)
+{
+	int other = cpumask_any_but(cpu_online_mask, cpu);
+
+	if(other >= nr_cpu_ids)
+	{
+		return -ENODEV;
+	}
+	ipi_cpu = cpu;
+	trigger_cpu = other;
+	return 0;
+}
+
+
+static const struct itr_backend backends[] =
+{
+	{ "gpio",	gpio_setup,	gpio_trigger,	gpio_release,	gpio_steer,
+			gpio_sync },
+	{ "irq_work",	irq_work_setup,	irq_work_trigger, irq_work_release,
+			irq_work_steer,	irq_work_release },
+	{ "ipi",	ipi_setup,	ipi_trigger,	ipi_release,	ipi_steer,
+			ipi_release },
+};
+
+
+/*
+ *	threaded bottom half
+ *
+ *	Details:
+ *		- a dummy irq descriptor with dummy_irq_chip carries a threaded
+ *		  handler; the interrupt handler fires it with
+ *		  generic_handle_irq, so any backend can wake an irq thread
+ */
+static irqreturn_t
+bh_hard_handler(int irq, void *dev_id)
+{
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t
+bh_thread_fn(int irq, void *dev_id)
+{
+	bh_record();
+	return IRQ_HANDLED;
+}
+
+static int
+threaded_setup(void)
+{
+	int ret = 0;
+
+	data_ptr->bh_irq = irq_alloc_desc(numa_node_id());
+	if(data_ptr->bh_irq < 0)
+	{
+		return data_ptr->bh_irq;
+	}
+	irq_set_chip_and_handler(data_ptr->bh_irq, &dummy_irq_chip,
+			handle_simple_irq);
+	irq_clear_status_flags(data_ptr->bh_irq, IRQ_NOREQUEST | IRQ_NOAUTOEN);
+
+	ret = request_threaded_irq(data_ptr->bh_irq, bh_hard_handler,
+			bh_thread_fn, 0, "itr_latency_bh", data_ptr);
+	if(ret)
+	{
+		printk(KERN_INFO "unable to claim irq %d\n", data_ptr->bh_irq);
+		irq_free_desc(data_ptr->bh_irq);
+	}
+	return ret;
+}
+
+static void
+threaded_fire(void)
+{
+	generic_handle_irq(data_ptr->bh_irq);
+}
+
+static void
+threaded_release(void)
+{
+	free_irq(data_ptr->bh_irq, data_ptr);
+	irq_free_desc(data_ptr->bh_irq);
+}
+
+/* waits for the irq thread too */
+static void
+threaded_sync(void)
+{
+	synchronize_irq(data_ptr->bh_irq);
+}
+
+
+/* tasklet bottom half, runs in TASKLET_SOFTIRQ */
+static void
+bh_tasklet_fn(unsigned long data)
+{
+	bh_record();
+}
+
+static int
+tasklet_setup_bh(void)
+{
+	tasklet_init(&data_ptr->bh_tasklet, bh_tasklet_fn, 0);
+	return 0;
+}
+
+static void
+tasklet_fire(void)
+{
+	tasklet_schedule(&data_ptr->bh_tasklet);
+}
+
+/*
+ *	also the sync: tasklet_kill waits for a scheduled tasklet to run, and
+ *	it can be scheduled again afterwards
+ */
+static void
+tasklet_release(void)
+{
+	tasklet_kill(&data_ptr->bh_tasklet);
+}
+
+
+/* workqueue bottom halves, the same work on three system workqueues */
+static void
+bh_work_fn(struct work_struct *work)
+{
+	bh_record();
+}
+
+static int
+work_setup(void)
+{
+	INIT_WORK(&data_ptr->bh_work, bh_work_fn);
 	return 0;
 }
+
+static void
+workqueue_fire(void)
+{
+	queue_work(system_wq, &data_ptr->bh_work);
+}
+
+static void
+wq_highpri_fire(void)
+{
+	queue_work(system_highpri_wq, &data_ptr->bh_work);
+}
+
+static void
+wq_unbound_fire(void)
+{
+	queue_work(system_unbound_wq, &data_ptr->bh_work);
+}
+
+static void
+work_release(void)
+{
+	cancel_work_sync(&data_ptr->bh_work);
+}
+
+static void
+work_sync(void)
+{
+	flush_work(&data_ptr->bh_work);
+}
+
+
+/*
+ *	fifo bottom half
+ *
+ *	Details:
+ *		- a kthread at SCHED_FIFO priority BH_FIFO_PRIO, woken by the
+ *		  interrupt handler with wake_up_process
+ *		- bh_pending stays raised until bh_record returned, so
+ *		  fifo_sync can wait for it; it is only dropped if no fire came
+ *		  in meanwhile, else the thread runs again for that one
+ */
+static int
+bh_fifo_fn(void *data)
+{
+	int pending = 0;
+
+	while(!kthread_should_stop())
+	{
+		set_current_state(TASK_INTERRUPTIBLE);
+		pending = atomic_read(&data_ptr->bh_pending);
+		if(!pending)
+		{
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		bh_record();
+		atomic_cmpxchg(&data_ptr->bh_pending, pending, 0);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int
+fifo_setup(void)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 9, 0)
+	struct sched_param param = { .sched_priority = BH_FIFO_PRIO };
+#endif
+
+	data_ptr->bh_task = kthread_run(bh_fifo_fn, NULL, "itr_latency_bh");
+	if(IS_ERR(data_ptr->bh_task))
+	{
+		return PTR_ERR(data_ptr->bh_task);
+	}
+
+	/* sched_setscheduler is no longer exported from 5.9 on */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	sched_set_fifo(data_ptr->bh_task);
+#else
+	sched_setscheduler(data_ptr->bh_task, SCHED_FIFO, &param);
+#endif
+	return 0;
+}
+
+static void
+fifo_fire(void)
+{
+	atomic_inc(&data_ptr->bh_pending);
+	wake_up_process(data_ptr->bh_task);
+}
+
+static void
+fifo_release(void)
+{
+	kthread_stop(data_ptr->bh_task);
+}
+
+static void
+fifo_sync(void)
+{
+	while(atomic_read(&data_ptr->bh_pending))
+	{
+		usleep_range(10, 20);
+	}
+}
+
+
+static const struct bh_path bh_paths[] =
+{
+	{ "hardirq",	NULL,		NULL,		NULL,		NULL,
+			false },
+	{ "threaded",	threaded_setup,	threaded_fire,	threaded_release,
+			threaded_sync,	true },
+	{ "tasklet",	tasklet_setup_bh, tasklet_fire,	tasklet_release,
+			tasklet_release, false },
+	{ "workqueue",	work_setup,	workqueue_fire,	work_release,	work_sync,
+			true },
+	{ "wq_highpri",	work_setup,	wq_highpri_fire, work_release,	work_sync,
+			true },
+	{ "wq_unbound",	work_setup,	wq_unbound_fire, work_release,	work_sync,
+			true },
+	{ "fifo",	fifo_setup,	fifo_fire,	fifo_release,	fifo_sync,
+			true },
+};
+
+
+/* percentile bucket of a latency */
+static u32
+lat_bucket(u32 ns)
+{
+	u32 e = 0;
+
+	if(ns < (1U << LAT_EXACT_BITS))
+	{
+		return ns;
+	}
+	e = ilog2(ns);
+	return (1U << LAT_EXACT_BITS) + (e - LAT_EXACT_BITS) * LAT_SUB
+		+ ((ns >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* smallest latency of a percentile bucket */
+static u32
+lat_bucket_ns(u32 i)
+{
+	u32 e = 0;
+
+	if(i < (1U << LAT_EXACT_BITS))
+	{
+		return i;
+	}
+	i -= 1U << LAT_EXACT_BITS;
+	e = LAT_EXACT_BITS + i / LAT_SUB;
+	return (1U << e) | ((i % LAT_SUB) << (e - LAT_SUB_BITS));
+}
+
+/*
+ *	record_latency
+ *
+ *	Details:
+ *		- counts one handled cycle, so the cost of the statistics does
+ *		  not grow with 'cycles': there is nothing to sort afterwards
+ */
+static void
+record_latency(u32 ns)
+{
+	if(!data_ptr->nr_samples || ns < data_ptr->min_ns)
+	{
+		data_ptr->min_ns = ns;
+	}
+	if(ns > data_ptr->max_ns)
+	{
+		data_ptr->max_ns = ns;
+	}
+	data_ptr->sum_ns += ns;
+	data_ptr->counts[lat_bucket(ns)]++;
+	data_ptr->nr_samples++;
+}
+
+
+/*
+ *	measure_interrupt_latency
+ *
+ *	Details:
+ *		- called by latency_module_init function
+ *		- raises 'cycles' interrupts through the backend
+ *		- timestamps time right before each interrupt is raised
+ *		- waits up to timeout_us for the bottom half, polling, or
+ *		  sleeping on "done" for a bottom half that is a thread, at
+ *		  least 2 jiffies since a sleep of 1 may end at the next tick
+ *		- only a bottom half fired for this cycle counts; after a miss
+ *		  it waits for the interrupt and bottom half still pending,
+ *		  so they can neither be taken for the next cycle nor run
+ *		  after their bottom half is released
+ *		- counts the latency of each cycle in the preallocated buckets,
+ *		  nothing is printed until all cycles ran
+ */
+static void
+measure_itr_latency(const struct itr_backend *b)
+{
+	unsigned long timeout = max_t(unsigned long, 2,
+			usecs_to_jiffies(timeout_us));
+	u64 trigger_ns = 0, latency = 0;
+	u32 seq = 0;
+	int i = 0, t = 0;
+	for(i = 0; i < cycles; i++)
+	{
+		seq = data_ptr->seq + 1;
+		if(!seq)
+		{
+			seq = 1;
+		}
+		WRITE_ONCE(data_ptr->seq, seq);
+		reinit_completion(&data_ptr->done);
+		trigger_ns = data_ptr->now();
+
+		b->trigger();
+
+		if(bh->sleeps)
+		{
+			wait_for_completion_timeout(&data_ptr->done, timeout);
+		}
+		for(t = 0; t < timeout_us && !bh->sleeps; t++)
+		{
+			if(smp_load_acquire(&data_ptr->handled) == seq)
+			{
+				break;
+			}
+			udelay(1);
+		}
+
+		if(smp_load_acquire(&data_ptr->handled) != seq)
+		{
+			data_ptr->missed_int++;
+			b->sync();
+			if(bh->sync)
+			{
+				bh->sync();
+			}
+		}
+		else
+		{
+			/* a clock that stepped back reads as 0 */
+			latency = data_ptr->handler_ns > trigger_ns ?
+				data_ptr->handler_ns - trigger_ns : 0;
+			record_latency(min_t(u64, latency, U32_MAX));
+		}
+
+		/* let others run on a kernel without preemption */
+		if((i & 1023) == 1023)
+		{
+			cond_resched();
+		}
+	}
+}
+
+/*
+ *	compute_stats
+ *
+ *	Details:
+ *		- fills "st" from the buckets of the last run in one pass
+ *		- min, avg and max are exact; a percentile is the smallest
+ *		  latency of the bucket it falls in, exact below 65 us and
+ *		  at most 1.6% low above
+ */
+static void
+compute_stats(struct latency_stats *st)
+{
+	static const u32 ppm[] = { 500000, 990000, 999900 };
+	u32 *out[] = { &st->p50, &st->p99, &st->p9999 };
+	u32 n = data_ptr->nr_samples, i = 0, p = 0;
+	u64 seen = 0, rank = 0;
+
+	memset(st, 0, sizeof(*st));
+	st->n = n;
+	st->missed = data_ptr->missed_int;
+	if(!n)
+	{
+		return;
+	}
+
+	st->min = data_ptr->min_ns;
+	st->avg = div_u64(data_ptr->sum_ns, n);
+	st->max = data_ptr->max_ns;
+
+	/* the latency below which ppm / 1000000 of the cycles fall */
+	rank = max_t(u64, 1, div_u64((u64)n * ppm[0] + 999999, 1000000));
+	for(i = 0; i < LAT_BUCKETS && p < ARRAY_SIZE(ppm); i++)
+	{
+		seen += data_ptr->counts[i];
+		while(p < ARRAY_SIZE(ppm) && seen >= rank)
+		{
+			*out[p++] = lat_bucket_ns(i);
+			if(p < ARRAY_SIZE(ppm))
+			{
+				rank = max_t(u64, 1,
+					div_u64((u64)n * ppm[p] + 999999, 1000000));
+			}
+		}
+	}
+}
+
+
+/*
+ *	report_latency
+ *
+ *	Details:
+ *		- prints min, avg, p50, p99, p99.99 and max of the last run
+ *		  as one "key=value" line
+ *		- prints a log2 histogram, one line per non empty bucket
+ */
+static void
+report_latency(const struct itr_backend *b, const struct latency_stats *st)
+{
+	u32 hist[HIST_BUCKETS] = { 0 };
+	u32 ns = 0;
+	int i = 0;
+
+	if(!st->n)
+	{
+		printk(KERN_INFO "latency: backend=%s bh=%s load=%s cycles=%u missed=%u\n",
+			b->name, bh->name, load_name, cycles, st->missed);
+		return;
+	}
+
+	/* no percentile bucket spans two powers of two */
+	for(i = 0; i < LAT_BUCKETS; i++)
+	{
+		ns = lat_bucket_ns(i);
+		hist[ns ? ilog2(ns) : 0] += data_ptr->counts[i];
+	}
+
+	printk(KERN_INFO "latency: backend=%s bh=%s load=%s clock=%s cycles=%u "
+		"missed=%u min_ns=%u avg_ns=%llu p50_ns=%u p99_ns=%u p99.99_ns=%u "
+		"max_ns=%u\n", b->name, bh->name, load_name, clock_name, cycles,
+		st->missed, st->min, st->avg, st->p50, st->p99, st->p9999, st->max);
+
+	for(i = 0; i < HIST_BUCKETS; i++)
+	{
+		if(hist[i])
+		{
+			printk(KERN_INFO "latency: hist %u-%u ns: %u\n",
+				i ? 1U << i : 0, (u32)((2ULL << i) - 1), hist[i]);
+		}
+	}
+}
+
+static long
+measure_on_cpu(void *b)
+{
+	measure_itr_latency(b);
+	return 0;
+}
+
+
+/*
+ *	run_cycles
+ *
+ *	Details:
+ *		- clears the buckets and runs 'cycles' cycles, in a kworker
+ *		  bound to trigger_cpu if the backend set one
+ */
+static void
+run_cycles(const struct itr_backend *b)
+{
+	memset(data_ptr->counts, 0, LAT_BUCKETS * sizeof(u32));
+	data_ptr->nr_samples = 0;
+	data_ptr->sum_ns = 0;
+	data_ptr->min_ns = 0;
+	data_ptr->max_ns = 0;
+	data_ptr->missed_int = 0;
+
+	if(trigger_cpu >= 0)
+	{
+		work_on_cpu(trigger_cpu, measure_on_cpu, (void *)b);
+	}
+	else
+	{
+		measure_itr_latency(b);
+	}
+}
+
+
+/*
+ *	sweep_latency
+ *
+ *	Details:
+ *		- steers the interrupt to every CPU of "mask" that is online
+ *		  in turn, runs the cycles and keeps the statistics of each
+ *		- prints a table with one row per CPU and its NUMA node
+ *		- holds the CPU hotplug lock so no swept CPU goes away
+ */
+static void
+sweep_latency(const struct itr_backend *b, const struct cpumask *mask)
+{
+	struct latency_stats *st;
+	int cpu = 0;
+
+	st = kcalloc(nr_cpu_ids, sizeof(*st), GFP_KERNEL);
+	if(!st)
+	{
+		printk(KERN_INFO "bad kcalloc\n");
+		return;
+	}
+
+	cpus_read_lock();
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+	{
+		st[cpu].ret = b->steer(cpu);
+		if(!st[cpu].ret)
+		{
+			run_cycles(b);
+			compute_stats(&st[cpu]);
+		}
+	}
+
+	printk(KERN_INFO "latency: backend=%s bh=%s load=%s clock=%s cycles=%u per cpu\n",
+		b->name, bh->name, load_name, clock_name, cycles);
+	printk(KERN_INFO "latency: %4s %4s %8s %8s %8s %8s %8s %8s %10s %8s\n",
+		"cpu", "node", "handled", "missed", "min_ns", "avg_ns", "p50_ns",
+		"p99_ns", "p99.99_ns", "max_ns");
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+	{
+		if(st[cpu].ret)
+		{
+			printk(KERN_INFO "latency: %4d %4d cannot steer the interrupt: %d\n",
+				cpu, cpu_to_node(cpu), st[cpu].ret);
+			continue;
+		}
+		printk(KERN_INFO "latency: %4d %4d %8u %8u %8u %8llu %8u %8u %10u %8u\n",
+			cpu, cpu_to_node(cpu), st[cpu].n, st[cpu].missed, st[cpu].min,
+			st[cpu].avg, st[cpu].p50, st[cpu].p99, st[cpu].p9999, st[cpu].max);
+	}
+	cpus_read_unlock();
+
+	kfree(st);
+}
+
+
+/*
+ *	load generators
+ *
+ *	Details:
+ *		- every generator of "load" runs as one kthread bound to every
+ *		  CPU of load_cpus, at normal priority
+ *		- cpu: busy for 1 ms at a time, so bottom halves that are
+ *		  threads compete for the CPU
+ *		- nopreempt: spins load_window_us with preemption disabled, so
+ *		  nothing else but interrupts and softirqs runs on the CPU
+ *		- membw: copies a load_mem_kb buffer back and forth, to load
+ *		  the caches and the memory bus
+ *		- alloc: allocates and frees slab objects and pages of mixed
+ *		  sizes, to load the allocators and their locks
+ *		- each one calls cond_resched between rounds, so a kernel
+ *		  without preemption does not stall
+ */
+static int
+load_cpu_fn(void *data)
+{
+	u64 end = 0;
+
+	while(!kthread_should_stop())
+	{
+		end = local_clock() + NSEC_PER_MSEC;
+		while(local_clock() < end)
+		{
+			cpu_relax();
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+static int
+load_nopreempt_fn(void *data)
+{
+	u64 end = 0;
+
+	while(!kthread_should_stop())
+	{
+		preempt_disable();
+		end = local_clock() + (u64)load_window_us * NSEC_PER_USEC;
+		while(local_clock() < end)
+		{
+			cpu_relax();
+		}
+		preempt_enable();
+		cond_resched();
+	}
+	return 0;
+}
+
+static int
+load_membw_fn(void *data)
+{
+	size_t half = (size_t)load_mem_kb * 1024 / 2, off = 0, len = 0;
+	char *buf;
+
+	buf = vmalloc(2 * half);
+	if(!buf)
+	{
+		/* kthread_stop still expects the thread to wait for it */
+		while(!kthread_should_stop())
+		{
+			schedule_timeout_interruptible(HZ);
+		}
+		return -ENOMEM;
+	}
+	memset(buf, 0x5a, 2 * half);
+
+	while(!kthread_should_stop())
+	{
+		/* 1 MiB at a time, each way */
+		for(off = 0; off < half; off += len)
+		{
+			len = min_t(size_t, SZ_1M, half - off);
+			memcpy(buf + half + off, buf + off, len);
+			memcpy(buf + off, buf + half + off, len);
+			cond_resched();
+		}
+	}
+	vfree(buf);
+	return 0;
+}
+
+static int
+load_alloc_fn(void *data)
+{
+	void *objs[64];
+	struct page *page;
+	int i = 0;
+
+	while(!kthread_should_stop())
+	{
+		/* 64 B to 64 KiB */
+		for(i = 0; i < ARRAY_SIZE(objs); i++)
+		{
+			objs[i] = kmalloc(64 << (i % 11), GFP_KERNEL);
+		}
+		for(i = 0; i < ARRAY_SIZE(objs); i++)
+		{
+			kfree(objs[i]);
+		}
+
+		/* orders 0 to 3 */
+		for(i = 0; i < 4; i++)
+		{
+			page = alloc_pages(GFP_KERNEL, i);
+			if(page)
+			{
+				__free_pages(page, i);
+			}
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+static const struct
+{
+	const char *name;
+	int (*fn)(void *data);
+}
+load_gens[] =
+{
+	{ "cpu",	load_cpu_fn },
+	{ "nopreempt",	load_nopreempt_fn },
+	{ "membw",	load_membw_fn },
+	{ "alloc",	load_alloc_fn },
+};
+
+/* one thread per generator and CPU, [gen * nr_cpu_ids + cpu] */
+static struct task_struct **load_tasks;
+
+static void
+stop_load(void)
+{
+	int i = 0;
+
+	for(i = 0; i < ARRAY_SIZE(load_gens) * nr_cpu_ids; i++)
+	{
+		if(load_tasks[i])
+		{
+			kthread_stop(load_tasks[i]);
+		}
+	}
+	kfree(load_tasks);
+	load_tasks = NULL;
+}
+
+
+/*
+ *	start_load
+ *
+ *	Details:
+ *		- starts the generators of "gen_mask" on the online CPUs of
+ *		  "mask"
+ *		- returns 0 on success, error otherwise
+ */
+static int
+start_load(unsigned long gen_mask, const struct cpumask *mask)
+{
+	struct task_struct *t;
+	int gen = 0, cpu = 0;
+
+	load_tasks = kcalloc(ARRAY_SIZE(load_gens) * nr_cpu_ids,
+			sizeof(*load_tasks), GFP_KERNEL);
+	if(!load_tasks)
+	{
+		return -ENOMEM;
+	}
+
+	for(gen = 0; gen < ARRAY_SIZE(load_gens); gen++)
+	{
+		if(!(gen_mask & (1UL << gen)))
+		{
+			continue;
+		}
+		for_each_cpu_and(cpu, mask, cpu_online_mask)
+		{
+			t = kthread_create(load_gens[gen].fn, NULL, "itr_%s/%d",
+				load_gens[gen].name, cpu);
+			if(IS_ERR(t))
+			{
+				stop_load();
+				return PTR_ERR(t);
+			}
+			kthread_bind(t, cpu);
+			load_tasks[gen * nr_cpu_ids + cpu] = t;
+			wake_up_process(t);
+		}
+	}
+	return 0;
+}
+
+
+/*
+ *	parse_load
+ *
+ *	Details:
+ *		- sets a bit in "gen_mask" for every generator of the comma
+ *		  separated "load" list, and "cpu" for "stress"
+ *		- fills "mask" from load_cpus, all possible CPUs if unset
+ *		- returns 0 on success, -EINVAL on an unknown name or a bad list
+ */
+static int
+parse_load(unsigned long *gen_mask, struct cpumask *mask)
+{
+	char *list, *pos, *name;
+	int ret = 0, i = 0;
+
+	*gen_mask = stress ? 1UL : 0;
+
+	cpumask_copy(mask, cpu_possible_mask);
+	if(load_cpus && *load_cpus && cpulist_parse(load_cpus, mask) < 0)
+	{
+		return -EINVAL;
+	}
+
+	if(!load_names || !*load_names)
+	{
+		return 0;
+	}
+
+	list = kstrdup(load_names, GFP_KERNEL);
+	if(!list)
+	{
+		return -ENOMEM;
+	}
+
+	pos = list;
+	while((name = strsep(&pos, ",")) != NULL)
+	{
+		for(i = 0; i < ARRAY_SIZE(load_gens); i++)
+		{
+			if(!strcmp(name, load_gens[i].name))
+			{
+				*gen_mask |= 1UL << i;
+				break;
+			}
+		}
+		if(*name && i == ARRAY_SIZE(load_gens))
+		{
+			ret = -EINVAL;
+		}
+	}
+	kfree(list);
+	return ret;
+}
+
+
+/*
+ *	parse_bh
+ *
+ *	Details:
+ *		- sets a bit in "mask" for every bottom half the comma separated
+ *		  "bh" list names, all of them for "all"
+ *		- returns 0 on success, -EINVAL on an unknown name
+ */
+static int
+parse_bh(unsigned long *mask)
+{
+	char *list, *pos, *name;
+	int ret = 0, i = 0;
+
+	list = kstrdup(bh_names, GFP_KERNEL);
+	if(!list)
+	{
+		return -ENOMEM;
+	}
+
+	pos = list;
+	while((name = strsep(&pos, ",")) != NULL)
+	{
+		if(!strcmp(name, "all"))
+		{
+			*mask |= (1UL << ARRAY_SIZE(bh_paths)) - 1;
+			continue;
+		}
+		for(i = 0; i < ARRAY_SIZE(bh_paths); i++)
+		{
+			if(!strcmp(name, bh_paths[i].name))
+			{
+				*mask |= 1UL << i;
+				break;
+			}
+		}
+		if(*name && i == ARRAY_SIZE(bh_paths))
+		{
+			ret = -EINVAL;
+		}
+	}
+	kfree(list);
+
+	return ret ? ret : (*mask ? 0 : -EINVAL);
+}
+
+
+/*
+ *	measure_bh
+ *
+ *	Details:
+ *		- measures the current bottom half once, or once per CPU with
+ *		  "sweep", and reports it
+ */
+static void
+measure_bh(const struct itr_backend *b, const struct cpumask *mask)
+{
+	struct latency_stats st;
+
+	if(sweep)
+	{
+		sweep_latency(b, mask);
+	}
+	else
+	{
+		run_cycles(b);
+		compute_stats(&st);
+		report_latency(b, &st);
+	}
+}
+
+
+/*
+ *	latency_module_init
+ *
+ *	Details:
+ *		- looks up the backend named by the "backend" parameter
+ *		- preallocates one sample per cycle
+ *		- lets the backend claim its interrupt source and register
+ *		  its handler
+ *		- measures every bottom half of "bh", each once, or once per
+ *		  CPU with "sweep", and again while the "load" generators run
+ *		- calls helper functions
+ *		- returns 0 on success, error otherwise
+ */
+static int 
+__init latency_module_init(void)
+{
+	const struct itr_backend *b = NULL;
+	unsigned long bh_mask = 0, load_mask = 0;
+	cpumask_var_t mask, load_cpu_mask;
+	char load_label[64];
+	int ret = 0, i = 0, load = 0;
+
+	for(i = 0; i < ARRAY_SIZE(backends); i++)
+	{
+		if(!strcmp(backend, backends[i].name))
+		{
+			b = &backends[i];
+		}
+	}
+	if(!b)
+	{
+		printk(KERN_INFO "unknown backend %s\n", backend);
+		return -EINVAL;
+	}
+
+	if(cycles == 0 || cycles > MAX_CYCLES)
+	{
+		printk(KERN_INFO "cycles must be 1 - %d\n", MAX_CYCLES);
+		return -EINVAL;
+	}
+
+	if(parse_bh(&bh_mask))
+	{
+		printk(KERN_INFO "invalid bh %s\n", bh_names);
+		return -EINVAL;
+	}
+
+	/* the CPUs to sweep and to load */
+	if(!alloc_cpumask_var(&mask, GFP_KERNEL))
+	{
+		return -ENOMEM;
+	}
+	if(!alloc_cpumask_var(&load_cpu_mask, GFP_KERNEL))
+	{
+		free_cpumask_var(mask);
+		return -ENOMEM;
+	}
+	if(parse_load(&load_mask, load_cpu_mask))
+	{
+		printk(KERN_INFO "invalid load %s or load_cpus %s\n",
+			load_names ? load_names : "", load_cpus ? load_cpus : "");
+		ret = -EINVAL;
+		goto free_mask;
+	}
+	cpumask_copy(mask, cpu_possible_mask);
+	if(cpus && *cpus)
+	{
+		if(cpulist_parse(cpus, mask) < 0)
+		{
+			printk(KERN_INFO "invalid cpus %s\n", cpus);
+			ret = -EINVAL;
+			goto free_mask;
+		}
+		sweep = true;
+	}
+
+	/* allocate memory for the itr_latency_data structure */
+	data_ptr = kzalloc(sizeof(struct itr_latency_data), GFP_KERNEL);
+	if(!data_ptr)
+	{
+		printk(KERN_INFO "bad kzalloc\n");
+		ret = -ENOMEM;
+		goto free_mask;
+	}
+	init_completion(&data_ptr->done);
+	bh = &bh_paths[0];
+
+	if(!strcmp(clock_name, "local"))
+	{
+		data_ptr->now = local_clock;
+	}
+	else if(!strcmp(clock_name, "ktime"))
+	{
+		data_ptr->now = ktime_get_ns;
+	}
+	else
+	{
+		printk(KERN_INFO "unknown clock %s\n", clock_name);
+		ret = -EINVAL;
+		goto free_data;
+	}
+
+	/* the latency buckets, allocated before the first cycle */
+	data_ptr->counts = vmalloc(array_size(LAT_BUCKETS, sizeof(u32)));
+	if(!data_ptr->counts)
+	{
+		printk(KERN_INFO "bad vmalloc\n");
+		ret = -ENOMEM;
+		goto free_data;
+	}
+
+	ret = b->setup();
+	if(ret)
+	{
+		vfree(data_ptr->counts);
+		goto free_data;
+	}
+
+	printk(KERN_INFO "%s: module loaded, backend %s\n", __FUNCTION__, b->name);
+
+	/* the generators running, e.g. "cpu+membw" */
+	load_label[0] = '\0';
+	for(i = 0; i < ARRAY_SIZE(load_gens); i++)
+	{
+		if(load_mask & (1UL << i))
+		{
+			if(load_label[0])
+			{
+				strlcat(load_label, "+", sizeof(load_label));
+			}
+			strlcat(load_label, load_gens[i].name, sizeof(load_label));
+		}
+	}
+
+	/* every bottom half idle, then under load */
+	for(i = 0; i < ARRAY_SIZE(bh_paths); i++)
+	{
+		if(!(bh_mask & (1UL << i)))
+		{
+			continue;
+		}
+		if(bh_paths[i].setup && bh_paths[i].setup())
+		{
+			printk(KERN_INFO "cannot set up bottom half %s\n",
+				bh_paths[i].name);
+			continue;
+		}
+		bh = &bh_paths[i];
+
+		for(load = 0; load <= !!load_mask; load++)
+		{
+			if(load && start_load(load_mask, load_cpu_mask))
+			{
+				printk(KERN_INFO "cannot start load threads\n");
+				break;
+			}
+			load_name = load ? load_label : "none";
+			measure_bh(b, mask);
+			if(load)
+			{
+				stop_load();
+			}
+		}
+
+		/* the interrupt must not defer to a freed bottom half */
+		bh = &bh_paths[0];
+		if(bh_paths[i].release)
+		{
+			bh_paths[i].release();
+		}
+	}
+	b->release();
+
+	free_cpumask_var(load_cpu_mask);
+	free_cpumask_var(mask);
+	vfree(data_ptr->counts);
+	kfree(data_ptr);
+	
+	return 0;
+
+free_data:
+	kfree(data_ptr);
+free_mask:
+	free_cpumask_var(load_cpu_mask);
+	free_cpumask_var(mask);
+	return ret;
+}
 module_init(latency_module_init);
 
 
@@ -7,7 +7,34 @@
 #ifndef _TEST_ITR_LATENCY_H_
 #define _TEST_ITR_LATENCY_H_
 
-#define TOTAL_CYCLES 10
+/* default and largest number of measured cycles */
+#define TOTAL_CYCLES 1000000
+#define MAX_CYCLES 50000000
+
+/* how long a cycle waits for the handler before counting it missed */
+#define HANDLER_TIMEOUT_US 1000
+
+/* priority of the SCHED_FIFO bottom half thread */
+#define BH_FIFO_PRIO 50
+
+/* default time a nopreempt load thread spins with preemption disabled */
+#define LOAD_WINDOW_US 100
+
+/* default buffer a membw load thread copies, in KiB */
+#define LOAD_MEM_KB 8192
+
+/* log2 buckets of the latency histogram, the last one holds >= 2^31 ns */
+#define HIST_BUCKETS 32
+
+/*
+ *	buckets the percentiles are taken from: one per ns below
+ *	2^LAT_EXACT_BITS ns (65 us), above that every power of two is split
+ *	into LAT_SUB linear buckets (1.6% wide) up to 2^32 ns
+ */
+#define LAT_EXACT_BITS 16
+#define LAT_SUB_BITS 6
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((1 << LAT_EXACT_BITS) + (32 - LAT_EXACT_BITS) * LAT_SUB)
 
 /*	13 and 34 correspond to linux pin_no
  *	and level shifter pin resp. for GPIO2
@@ -0,0 +1,604 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/mempool.h>
+#include <linux/string.h>
+#include <linux/sort.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/timekeeping.h>
+#include <linux/preempt.h>
+#include <linux/sched.h>
+
+#include "alloc_bench.h"
+
+static char *alloc_names;
+module_param_named(allocs, alloc_names, charp, 0444);
+MODULE_PARM_DESC(allocs, "allocators to measure: kmalloc, kzalloc, vmalloc, kvmalloc, alloc_pages, kmem_cache, mempool (comma separated, default all)");
+
+static char *gfp_names;
+module_param_named(gfp, gfp_names, charp, 0444);
+MODULE_PARM_DESC(gfp, "gfp flags to measure: kernel, atomic (comma separated, default both)");
+
+static unsigned long min_size = AB_MIN_SIZE;
+module_param(min_size, ulong, 0444);
+MODULE_PARM_DESC(min_size, "smallest size in bytes, rounded up to a power of two");
+
+static unsigned long max_size;
+module_param(max_size, ulong, 0444);
+MODULE_PARM_DESC(max_size, "largest size in bytes (default PAGE_SIZE << max order)");
+
+static unsigned int rounds = AB_ROUNDS;
+module_param(rounds, uint, 0444);
+MODULE_PARM_DESC(rounds, "rounds of every allocator, gfp and size");
+
+/*
+ *	struct ab_run - one allocator, gfp and size being measured
+ *
+ *	@size	: bytes of every object
+ *	@gfp	: flags of every allocation
+ *	@nr	: objects held at once in one round
+ *	@order	: page order of size, for alloc_pages
+ *	@cache	: cache of size objects, for kmem_cache
+ *	@pool	: pool of nr size objects, for mempool
+ */
+struct ab_run
+{
+	size_t size;
+	gfp_t gfp;
+	unsigned int nr;
+	unsigned int order;
+	struct kmem_cache *cache;
+	mempool_t *pool;
+};
+
+/*
+ *	struct ab_alloc - one allocator
+ *
+ *	@name		: name in the allocs parameter and the table
+ *	@setup		: creates what alloc needs for a run, optional
+ *	@alloc		: allocates one object of the run
+ *	@free		: frees one object of alloc
+ *	@release	: undoes setup, optional
+ *	@min_size	: smallest size that makes sense
+ *	@max_size	: largest size the allocator takes
+ *	@sleeps		: cannot be called with GFP_ATOMIC
+ */
+struct ab_alloc
+{
+	const char *name;
+	int (*setup)(struct ab_run *r);
+	void *(*alloc)(struct ab_run *r);
+	void (*free)(struct ab_run *r, void *p);
+	void (*release)(struct ab_run *r);
+	size_t min_size;
+	size_t max_size;
+	bool sleeps;
+};
+
+/* summary of the latencies of one operation */
+struct ab_stats
+{
+	u64 sum;
+	u32 min;
+	u32 avg;
+	u32 p50;
+	u32 p99;
+	u32 max;
+};
+
+/* latencies of the allocations and frees of one run, rounds * AB_BATCH each */
+static u32 *alloc_ns, *free_ns;
+
+/* objects held in one round */
+static void **objs;
+
+
+static void *
+ab_kmalloc(struct ab_run *r)
+{
+	return kmalloc(r->size, r->gfp);
+}
+
+static void *
+ab_kzalloc(struct ab_run *r)
+{
+	return kzalloc(r->size, r->gfp);
+}
+
+static void
+ab_kfree(struct ab_run *r, void *p)
+{
+	kfree(p);
+}
+
+static void *
+ab_vmalloc(struct ab_run *r)
+{
+	return vmalloc(r->size);
+}
+
+static void
+ab_vfree(struct ab_run *r, void *p)
+{
+	vfree(p);
+}
+
+static void *
+ab_kvmalloc(struct ab_run *r)
+{
+	return kvmalloc(r->size, r->gfp);
+}
+
+static void
+ab_kvfree(struct ab_run *r, void *p)
+{
+	kvfree(p);
+}
+
+static int
+ab_pages_setup(struct ab_run *r)
+{
+	r->order = get_order(r->size);
+	return 0;
+}
+
+static void *
+ab_alloc_pages(struct ab_run *r)
+{
+	return alloc_pages(r->gfp, r->order);
+}
+
+static void
+ab_free_pages(struct ab_run *r, void *p)
+{
+	__free_pages(p, r->order);
+}
+
+/*
+ *	the cache must not be merged into the kmalloc cache of the same size,
+ *	or the kmem_cache rows would measure kmalloc's slabs; SLAB_NO_MERGE
+ *	exists from 6.5, before that slab_nomerge on the command line does it
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define AB_CACHE_FLAGS SLAB_NO_MERGE
+#else
+#define AB_CACHE_FLAGS 0
+#endif
+
+static int
+ab_cache_setup(struct ab_run *r)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "alloc_bench-%zu", r->size);
+	r->cache = kmem_cache_create(name, r->size, 0, AB_CACHE_FLAGS, NULL);
+	return r->cache ? 0 : -ENOMEM;
+}
+
+static void *
+ab_cache_alloc(struct ab_run *r)
+{
+	return kmem_cache_alloc(r->cache, r->gfp);
+}
+
+static void
+ab_cache_free(struct ab_run *r, void *p)
+{
+	kmem_cache_free(r->cache, p);
+}
+
+static void
+ab_cache_release(struct ab_run *r)
+{
+	kmem_cache_destroy(r->cache);
+	r->cache = NULL;
+}
+
+/*
+ *	the pool reserves a whole round, so a GFP_KERNEL mempool_alloc never
+ *	waits for an element to come back
+ */
+static int
+ab_pool_setup(struct ab_run *r)
+{
+	r->pool = mempool_create_kmalloc_pool(r->nr, r->size);
+	return r->pool ? 0 : -ENOMEM;
+}
+
+static void *
+ab_pool_alloc(struct ab_run *r)
+{
+	return mempool_alloc(r->pool, r->gfp);
+}
+
+static void
+ab_pool_free(struct ab_run *r, void *p)
+{
+	mempool_free(p, r->pool);
+}
+
+static void
+ab_pool_release(struct ab_run *r)
+{
+	mempool_destroy(r->pool);
+	r->pool = NULL;
+}
+
+/*
+ *	kmalloc and the caches and pools built on it stop at KMALLOC_MAX_SIZE;
+ *	vmalloc always sleeps, and kvmalloc only falls back to vmalloc for
+ *	flags that allow it to, so both are measured with GFP_KERNEL only
+ */
+static const struct ab_alloc ab_allocs[] =
+{
+	{
+		.name = "kmalloc", .alloc = ab_kmalloc, .free = ab_kfree,
+		.max_size = KMALLOC_MAX_SIZE,
+	},
+	{
+		.name = "kzalloc", .alloc = ab_kzalloc, .free = ab_kfree,
+		.max_size = KMALLOC_MAX_SIZE,
+	},
+	{
+		.name = "vmalloc", .alloc = ab_vmalloc, .free = ab_vfree,
+		.max_size = AB_MAX_SIZE, .sleeps = true,
+	},
+	{
+		.name = "kvmalloc", .alloc = ab_kvmalloc, .free = ab_kvfree,
+		.max_size = AB_MAX_SIZE, .sleeps = true,
+	},
+	{
+		.name = "alloc_pages", .setup = ab_pages_setup,
+		.alloc = ab_alloc_pages, .free = ab_free_pages,
+		.min_size = PAGE_SIZE, .max_size = AB_MAX_SIZE,
+	},
+	{
+		.name = "kmem_cache", .setup = ab_cache_setup,
+		.alloc = ab_cache_alloc, .free = ab_cache_free,
+		.release = ab_cache_release, .max_size = KMALLOC_MAX_SIZE,
+	},
+	{
+		.name = "mempool", .setup = ab_pool_setup,
+		.alloc = ab_pool_alloc, .free = ab_pool_free,
+		.release = ab_pool_release, .max_size = KMALLOC_MAX_SIZE,
+	},
+};
+
+static const struct
+{
+	const char *name;
+	gfp_t gfp;
+}
+ab_gfps[] =
+{
+	{ "kernel",	GFP_KERNEL },
+	{ "atomic",	GFP_ATOMIC },
+};
+
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ *	compute_stats
+ *
+ *	Details:
+ *		- sorts the "n" latencies of "ns" and fills "st" from them
+ */
+static void
+compute_stats(u32 *ns, unsigned int n, struct ab_stats *st)
+{
+	unsigned int i = 0;
+
+	memset(st, 0, sizeof(*st));
+	if(!n)
+	{
+		return;
+	}
+
+	sort(ns, n, sizeof(u32), cmp_u32, NULL);
+	for(i = 0; i < n; i++)
+	{
+		st->sum += ns[i];
+	}
+
+	st->min = ns[0];
+	st->avg = div_u64(st->sum, n);
+	st->p50 = ns[(n - 1) / 2];
+	st->p99 = ns[div_u64((u64)n * 99 + 99, 100) - 1];
+	st->max = ns[n - 1];
+}
+
+
+/*
+ *	parse_list
+ *
+ *	Details:
+ *		- sets bit i of "mask" for every name of the comma separated
+ *		  "list" that matches "name_of(i)", all "nr" if "list" is unset
+ *		- returns 0 on success, -EINVAL on an unknown name
+ */
+static int
+parse_list(const char *list, const char *(*name_of)(int i), int nr,
+	   unsigned long *mask)
+{
+	char *copy, *pos, *name;
+	int ret = 0, i = 0;
+
+	if(!list || !*list)
+	{
+		*mask = (1UL << nr) - 1;
+		return 0;
+	}
+
+	copy = kstrdup(list, GFP_KERNEL);
+	if(!copy)
+	{
+		return -ENOMEM;
+	}
+
+	*mask = 0;
+	pos = copy;
+	while((name = strsep(&pos, ",")) != NULL)
+	{
+		for(i = 0; i < nr; i++)
+		{
+			if(!strcmp(name, name_of(i)))
+			{
+				*mask |= 1UL << i;
+				break;
+			}
+		}
+		if(*name && i == nr)
+		{
+			ret = -EINVAL;
+		}
+	}
+	kfree(copy);
+	return ret;
+}
+
+static const char *
+alloc_name(int i)
+{
+	return ab_allocs[i].name;
+}
+
+static const char *
+gfp_name(int i)
+{
+	return ab_gfps[i].name;
+}
+
+
+/*
+ *	run_bench
+ *
+ *	Details:
+ *		- allocates r->nr objects and frees them again, "rounds" times,
+ *		  timing every call with ktime_get_ns
+ *		- GFP_ATOMIC calls run with preemption disabled, as they would
+ *		  in a driver's atomic path
+ *		- prints one row of the table
+ */
+static void
+run_bench(const struct ab_alloc *a, const char *gfp_str, struct ab_run *r)
+{
+	struct ab_stats as, fs;
+	unsigned int round = 0, i = 0, na = 0, nf = 0, fail = 0;
+	bool atomic = !gfpflags_allow_blocking(r->gfp);
+	u64 t0 = 0, t1 = 0, ops_s = 0, mb_s = 0;
+
+	if(a->setup && a->setup(r))
+	{
+		printk(KERN_INFO "alloc_bench: # %s %s %zu: setup failed\n",
+			a->name, gfp_str, r->size);
+		return;
+	}
+
+	for(round = 0; round < rounds; round++)
+	{
+		for(i = 0; i < r->nr; i++)
+		{
+			if(atomic)
+			{
+				preempt_disable();
+			}
+			t0 = ktime_get_ns();
+			objs[i] = a->alloc(r);
+			t1 = ktime_get_ns();
+			if(atomic)
+			{
+				preempt_enable();
+			}
+
+			if(objs[i])
+			{
+				alloc_ns[na++] = min_t(u64, t1 - t0, U32_MAX);
+			}
+			else
+			{
+				fail++;
+			}
+		}
+
+		for(i = 0; i < r->nr; i++)
+		{
+			if(!objs[i])
+			{
+				continue;
+			}
+			if(atomic)
+			{
+				preempt_disable();
+			}
+			t0 = ktime_get_ns();
+			a->free(r, objs[i]);
+			t1 = ktime_get_ns();
+			if(atomic)
+			{
+				preempt_enable();
+			}
+			free_ns[nf++] = min_t(u64, t1 - t0, U32_MAX);
+		}
+
+		cond_resched();
+	}
+
+	if(a->release)
+	{
+		a->release(r);
+	}
+
+	compute_stats(alloc_ns, na, &as);
+	compute_stats(free_ns, nf, &fs);
+
+	/*
+	 *	alloc and free pairs per second spent in the calls, and MiB
+	 *	allocated per second spent in alloc
+	 */
+	if(as.sum + fs.sum)
+	{
+		ops_s = div64_u64((u64)na * NSEC_PER_SEC, as.sum + fs.sum);
+	}
+	if(as.sum)
+	{
+		mb_s = mul_u64_u64_div_u64((u64)na * r->size, NSEC_PER_SEC,
+					   as.sum) >> 20;
+	}
+
+	printk(KERN_INFO "alloc_bench: %-11s %-6s %8zu %7u %5u %8u %8u %8u %8u %8u %8u %8u %8u %8u %8u %10llu %8llu\n",
+		a->name, gfp_str, r->size, na, fail,
+		as.min, as.avg, as.p50, as.p99, as.max,
+		fs.min, fs.avg, fs.p50, fs.p99, fs.max, ops_s, mb_s);
+}
+
+
+/*
+ *	alloc_bench_init - init function of module
+ *
+ *	Details:
+ *		- called when module loaded into kernel
+ *		- measures the latency and throughput of allocating and
+ *		  freeing with every allocator of "allocs", every flag of
+ *		  "gfp" and every power of two from min_size to max_size
+ *		- GFP_ATOMIC is skipped for the allocators that sleep, and
+ *		  sizes outside of what an allocator takes are skipped
+ *		- prints one row per run, whitespace separated, under a
+ *		  header row; rows starting with "alloc_bench: #" are comments
+ */
+static int
+__init alloc_bench_init(void)
+{
+	unsigned long alloc_mask = 0, gfp_mask = 0;
+	struct ab_run r;
+	size_t first = 0, last = 0, size = 0;
+	int ret = 0, a = 0, g = 0;
+
+	if(!rounds || rounds > AB_MAX_ROUNDS)
+	{
+		printk(KERN_INFO "%s: rounds must be 1 to %d\n", __FUNCTION__,
+			AB_MAX_ROUNDS);
+		return -EINVAL;
+	}
+	if(parse_list(alloc_names, alloc_name, ARRAY_SIZE(ab_allocs), &alloc_mask) ||
+	   parse_list(gfp_names, gfp_name, ARRAY_SIZE(ab_gfps), &gfp_mask))
+	{
+		printk(KERN_INFO "%s: invalid allocs %s or gfp %s\n", __FUNCTION__,
+			alloc_names ? alloc_names : "", gfp_names ? gfp_names : "");
+		return -EINVAL;
+	}
+
+	first = roundup_pow_of_two(clamp_t(unsigned long, min_size, 1, AB_MAX_SIZE));
+	last = max_size && max_size < AB_MAX_SIZE ? max_size : AB_MAX_SIZE;
+
+	alloc_ns = vmalloc(array_size(rounds * AB_BATCH, sizeof(u32)));
+	free_ns = vmalloc(array_size(rounds * AB_BATCH, sizeof(u32)));
+	objs = kcalloc(AB_BATCH, sizeof(void *), GFP_KERNEL);
+	if(!alloc_ns || !free_ns || !objs)
+	{
+		ret = -ENOMEM;
+		goto free_bufs;
+	}
+
+	printk(KERN_INFO "%s: %u rounds, sizes %zu to %zu, max order %d\n",
+		__FUNCTION__, rounds, first, last, AB_MAX_ORDER);
+	printk(KERN_INFO "alloc_bench: %-11s %-6s %8s %7s %5s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s %10s %8s\n",
+		"alloc", "gfp", "size", "ops", "fail",
+		"a_min_ns", "a_avg_ns", "a_p50_ns", "a_p99_ns", "a_max_ns",
+		"f_min_ns", "f_avg_ns", "f_p50_ns", "f_p99_ns", "f_max_ns",
+		"ops_s", "mb_s");
+
+	for(a = 0; a < ARRAY_SIZE(ab_allocs); a++)
+	{
+		if(!(alloc_mask & (1UL << a)))
+		{
+			continue;
+		}
+		for(g = 0; g < ARRAY_SIZE(ab_gfps); g++)
+		{
+			if(!(gfp_mask & (1UL << g)))
+			{
+				continue;
+			}
+			if(ab_allocs[a].sleeps && !gfpflags_allow_blocking(ab_gfps[g].gfp))
+			{
+				printk(KERN_INFO "alloc_bench: # %s %s: skipped, the allocator sleeps\n",
+					ab_allocs[a].name, ab_gfps[g].name);
+				continue;
+			}
+
+			for(size = first; size && size <= last; size <<= 1)
+			{
+				if(size < ab_allocs[a].min_size ||
+				   size > ab_allocs[a].max_size)
+				{
+					continue;
+				}
+
+				/* failures are counted in the table, not logged */
+				memset(&r, 0, sizeof(r));
+				r.size = size;
+				r.gfp = ab_gfps[g].gfp | __GFP_NOWARN;
+				r.nr = clamp_t(size_t, (size_t)AB_BATCH_KB * 1024 / size,
+					       1, AB_BATCH);
+				run_bench(&ab_allocs[a], ab_gfps[g].name, &r);
+			}
+		}
+	}
+
+free_bufs:
+	kfree(objs);
+	vfree(free_ns);
+	vfree(alloc_ns);
+	return ret;
+}
+module_init(alloc_bench_init);
+
+
+/*
+ *	alloc_bench_exit - exit function of module
+ *
+ *	Details:
+ *		- called when module removed from kernel
+ */
+static void
+__exit alloc_bench_exit(void)
+{
+	printk(KERN_INFO "%s: removing module\n", __FUNCTION__);
+}
+module_exit(alloc_bench_exit);
+
+
+MODULE_AUTHOR("Sharvil Shah");
+MODULE_LICENSE("GPL v2");
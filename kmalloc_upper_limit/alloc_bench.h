@@ -0,0 +1,42 @@
+/*
+ *	alloc_bench.h
+ *
+ *	Definitions for the allocator benchmark module
+ */
+
+#ifndef _ALLOC_BENCH_H_
+#define _ALLOC_BENCH_H_
+
+#include <linux/version.h>
+#include <linux/mmzone.h>
+
+/*
+ *	largest order of the buddy allocator; MAX_ORDER was one past it before
+ *	6.4, is the order itself from 6.4 and became MAX_PAGE_ORDER in 6.8
+ */
+#if defined(MAX_PAGE_ORDER)
+#define AB_MAX_ORDER MAX_PAGE_ORDER
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define AB_MAX_ORDER MAX_ORDER
+#else
+#define AB_MAX_ORDER (MAX_ORDER - 1)
+#endif
+
+/* largest size measured, one block of the largest order */
+#define AB_MAX_SIZE (PAGE_SIZE << AB_MAX_ORDER)
+
+/* smallest size measured, sizes double from here */
+#define AB_MIN_SIZE 8
+
+/* default and largest number of rounds of every allocator, gfp and size */
+#define AB_ROUNDS 100
+#define AB_MAX_ROUNDS 10000
+
+/*
+ *	objects held at once in one round: AB_BATCH, fewer for large sizes so a
+ *	round holds at most AB_BATCH_KB, and at least one
+ */
+#define AB_BATCH 256
+#define AB_BATCH_KB 4096
+
+#endif /* _ALLOC_BENCH_H_ */
@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+#	alloc_bench.sh
+#
+#	Loads alloc_bench.ko once and prints its table as CSV, one row per
+#	allocator, gfp and size. Run as root after "make". Any arguments are
+#	passed on as module parameters.
+#
+#	usage: ./alloc_bench.sh [param=value...]
+#
+#	e.g.   ./alloc_bench.sh allocs=kmalloc,mempool gfp=atomic rounds=1000
+#
+
+if ! insmod ./alloc_bench.ko "$@"
+then
+	exit 1
+fi
+rmmod alloc_bench
+
+# the table of this run starts at the last header row; comment rows are
+# dropped
+dmesg | sed -n 's/.*alloc_bench: //p' | grep -v '^#' |
+awk '
+	$1 == "alloc" { n = 0 }
+	{ row[n++] = $0 }
+	END {
+		for(i = 0; i < n; i++)
+		{
+			gsub(/ +/, ",", row[i])
+			print row[i]
+		}
+	}'
@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+#	builtin_bench.sh
+#
+#	Measures how many commands per second my_shell runs for echo, printf,
+#	test, true and pwd as builtins, against the same commands run
+#	through fork/exec by giving their full path.
+#
+#	usage: bench/builtin_bench.sh [n_commands] [shell_binary]
+#
+
+N=${1:-5000}
+MY_SHELL=${2:-./my_shell}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# writes N command lines, cycling through $2..., to file $1
+gen()
+{
+	out=$1
+	shift
+	i=0
+	while [ "$i" -lt "$N" ]; do
+		for cmd in "$@"; do
+			printf '%s\n' "$cmd"
+		done
+		i=$((i + $#))
+	done > "$out"
+}
+
+gen "$TMP/builtin" "echo hello" "printf %s-%d\n x 1" "test 1 -lt 2" "true" "pwd"
+gen "$TMP/external" "/bin/echo hello" "/usr/bin/printf %s-%d\n x 1" \
+	"/usr/bin/test 1 -lt 2" "/bin/true" "/bin/pwd"
+: > "$TMP/empty"
+
+now_ns()
+{
+	date +%s%N
+}
+
+# prints elapsed ns of my_shell running command file $1
+run_shell()
+{
+	start=$(now_ns)
+	$MY_SHELL < "$1" > /dev/null 2>&1
+	end=$(now_ns)
+	echo $((end - start))
+}
+
+base=$(run_shell "$TMP/empty")
+printf "%-10s %12s\n" "path" "cmds/s"
+for path in external builtin; do
+	t=$(( $(run_shell "$TMP/$path") - base ))
+	printf "%-10s %12d\n" "$path" $((N * 1000000000 / t))
+done
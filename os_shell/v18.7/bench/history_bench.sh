@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+#	history_bench.sh
+#
+#	Fills a scratch history file with `entries` lines (default 1M, 10%
+#	of them distinct) and reports
+#	  - the wall time of `my_shell -c true`, which does not touch the file,
+#	  - the `time` of a first `history` lookup, which opens, maps,
+#	    deduplicates and sorts the file, and of a second one that reuses
+#	    the index.
+#
+#	usage: bench/history_bench.sh [entries] [shell_binary]
+#
+
+ENTRIES=${1:-1000000}
+MY_SHELL=${2:-./my_shell}
+HISTFILE=$(mktemp)
+SCRIPT=$(mktemp)
+export HISTFILE
+trap 'rm -f "$HISTFILE" "$SCRIPT"' EXIT
+
+now_ns()
+{
+	date +%s%N
+}
+
+awk -v n="$ENTRIES" 'BEGIN {
+	split("git ls make grep cd vim cat ssh", cmd, " ")
+	for(i = 0; i < n; i++)
+		printf "%s --arg %d\n", cmd[i % 8 + 1],
+				int(i / 8) * 7919 % (int(n / 80) + 1)
+}' > "$HISTFILE"
+
+printf 'time history -n 1 git\ntime history -n 1 git\n' > "$SCRIPT"
+
+echo "$(wc -l < "$HISTFILE") entries, $(sort -u "$HISTFILE" | wc -l) distinct"
+
+start=$(now_ns)
+"$MY_SHELL" -c true
+end=$(now_ns)
+echo "my_shell -c true: $(((end - start) / 1000)) us"
+
+echo "first and second lookup:"
+"$MY_SHELL" "$SCRIPT" 2>&1 >/dev/null | grep real
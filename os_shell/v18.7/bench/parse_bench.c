@@ -0,0 +1,200 @@
+/*
+ *	parse_bench.c
+ *
+ *	Parser throughput benchmark. Parses a corpus of command lines
+ *	(generated, or read from a file) with parse_cmd and reports lines/sec
+ *	and the number of heap calls made by the parser once warmed up.
+ *
+ *	Heap calls are counted by wrapping malloc/calloc/realloc/free at link
+ *	time, see the parse_bench target of the Makefile.
+ *
+ *	usage: bench/parse_bench [corpus_file]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>		/* clock_gettime() */
+
+#include "../shell.h"
+
+#define GEN_LINES 1000000
+#define PASSES 5
+
+static unsigned long heap_calls;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t n);
+void __real_free(void *p);
+
+void *__wrap_malloc(size_t n)
+{
+	heap_calls++;
+	return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+	heap_calls++;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t n)
+{
+	heap_calls++;
+	return __real_realloc(p, n);
+}
+
+void __wrap_free(void *p)
+{
+	heap_calls++;
+	__real_free(p);
+}
+
+
+/*
+ *	gen_corpus - builds GEN_LINES shell-like lines, one per '\n'
+ */
+static char *gen_corpus(size_t *size)
+{
+	static const char *words[] = {
+		"ls", "-la", "grep", "'foo bar'", "\"a \\\"quoted\\\" word\"",
+		"sort", "-u", "/usr/share/dict/words", "wc", "-l", "cat",
+		"x\\ y", "awk", "'{print $1}'", "head", "-n", "100",
+	};
+	const int n_words = sizeof(words) / sizeof(words[0]);
+	size_t cap = GEN_LINES * 64, len = 0;
+	char *buf = __real_malloc(cap);
+
+	srand(1);
+	for(int i = 0; i < GEN_LINES; i++)
+	{
+		int n = 1 + rand() % 12, piped = 1;
+
+		for(int w = 0; w < n; w++)
+		{
+			/* no empty stages: never two '|' in a row */
+			piped = !piped && rand() % 5 == 0;
+			len += snprintf(buf + len, cap - len, "%s%s", w ? " " : "",
+					piped ? "|" : words[rand() % n_words]);
+		}
+		/* a pipe must not end the line */
+		len += snprintf(buf + len, cap - len, " cat\n");
+	}
+
+	*size = len;
+	return buf;
+}
+
+
+/*
+ *	read_corpus - reads the whole corpus file
+ */
+static char *read_corpus(const char *file, size_t *size)
+{
+	FILE *f = fopen(file, "r");
+	char *buf;
+	long len;
+
+	if(!f)
+	{
+		perror(file);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	rewind(f);
+	buf = __real_malloc(len + 1);
+	*size = fread(buf, 1, len, f);
+	buf[*size] = '\0';
+	fclose(f);
+
+	return buf;
+}
+
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ *	parse_pass
+ *
+ *	Details:
+ *		- parses every line of the corpus once, each line is copied into
+ *		  line_buf first since parse_cmd works in place
+ *
+ *	Return value
+ *		- number of lines parsed
+ */
+static long parse_pass(const char *corpus, size_t size, char *line_buf,
+		struct arena *arena)
+{
+	const char *p = corpus, *end = corpus + size;
+	struct cmd_line cmd;
+	long lines = 0;
+
+	while(p < end)
+	{
+		const char *nl = memchr(p, '\n', end - p);
+		size_t len = (nl ? nl : end) - p;
+
+		memcpy(line_buf, p, len);
+		line_buf[len] = '\0';
+
+		arena_reset(arena);
+		parse_cmd(line_buf, arena, &cmd);
+
+		lines++;
+		p += len + 1;
+	}
+
+	return lines;
+}
+
+
+int main(int argc, char **argv)
+{
+	struct arena arena = { NULL };
+	size_t size, longest = 0, len = 0;
+	char *corpus, *line_buf;
+	unsigned long warm_calls;
+	double start, elapsed;
+	long lines = 0;
+
+	corpus = (argc > 1) ? read_corpus(argv[1], &size) : gen_corpus(&size);
+
+	for(size_t i = 0; i < size; i++)
+	{
+		len = (corpus[i] == '\n') ? 0 : len + 1;
+		longest = (len > longest) ? len : longest;
+	}
+	line_buf = __real_malloc(longest + 1);
+
+	/* the warm-up pass grows the arena to its high-water mark */
+	parse_pass(corpus, size, line_buf, &arena);
+	warm_calls = heap_calls;
+
+	start = now_s();
+	for(int i = 0; i < PASSES; i++)
+	{
+		lines += parse_pass(corpus, size, line_buf, &arena);
+	}
+	elapsed = now_s() - start;
+
+	printf("corpus:            %zu bytes\n", size);
+	printf("lines parsed:      %ld\n", lines);
+	printf("lines/sec:         %.0f\n", lines / elapsed);
+	printf("MB/sec:            %.1f\n", PASSES * size / elapsed / 1e6);
+	printf("warm-up heap calls: %lu\n", warm_calls);
+	printf("steady heap calls:  %lu\n", heap_calls - warm_calls);
+
+	arena_free(&arena);
+	return 0;
+}
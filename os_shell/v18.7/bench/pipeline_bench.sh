@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+#	pipeline_bench.sh
+#
+#	Compares end-to-end pipeline throughput of my_shell against /bin/sh
+#	for 2, 4 and 8 stage pipelines of the form
+#		cat <file> | cat | ... | wc -c
+#
+#	usage: bench/pipeline_bench.sh [size_MiB] [shell_binary]
+#
+
+SIZE_MB=${1:-256}
+MY_SHELL=${2:-./my_shell}
+
+DATA=$(mktemp)
+trap 'rm -f "$DATA"' EXIT
+head -c "${SIZE_MB}M" /dev/zero > "$DATA"
+
+now_ns()
+{
+	date +%s%N
+}
+
+# runs the command lines on stdin of shell $1, prints elapsed ns
+run_shell()
+{
+	start=$(now_ns)
+	printf '%s\nexit\n' "$2" | $1 > /dev/null 2>&1
+	end=$(now_ns)
+	echo $((end - start))
+}
+
+# builds an n stage pipeline
+pipeline()
+{
+	cmd="cat $DATA"
+	i=2
+	while [ "$i" -lt "$1" ]; do
+		cmd="$cmd | cat"
+		i=$((i + 1))
+	done
+	echo "$cmd | wc -c"
+}
+
+# fixed startup cost of each shell, subtracted from every run
+base_my=$(run_shell "$MY_SHELL" "")
+base_sh=$(run_shell /bin/sh "")
+
+printf "%-7s %14s %14s\n" "stages" "my_shell MB/s" "/bin/sh MB/s"
+for n in 2 4 8; do
+	cmd=$(pipeline "$n")
+	t_my=$(( $(run_shell "$MY_SHELL" "$cmd") - base_my ))
+	t_sh=$(( $(run_shell /bin/sh "$cmd") - base_sh ))
+	printf "%-7d %14d %14d\n" "$n" \
+		$((SIZE_MB * 1000000000 / t_my)) $((SIZE_MB * 1000000000 / t_sh))
+done
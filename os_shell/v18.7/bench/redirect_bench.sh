@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+#	redirect_bench.sh
+#
+#	Compares write throughput of
+#		head -c <size> /dev/zero > <file>
+#	with plain redirection and with the output preallocated by
+#	"prealloc", and prints the extents of each output (filefrag).
+#
+#	usage: bench/redirect_bench.sh [size_MiB] [shell_binary] [dir]
+#
+
+SIZE_MB=${1:-4096}
+MY_SHELL=${2:-./my_shell}
+
+TMP=$(mktemp -d ${3:+-p "$3"})
+trap 'rm -rf "$TMP"' EXIT
+
+now_ns()
+{
+	date +%s%N
+}
+
+# runs the command lines in $1 with my_shell, prints elapsed ns
+run_shell()
+{
+	sync
+	start=$(now_ns)
+	printf '%s\n' "$1" | $MY_SHELL > /dev/null
+	end=$(now_ns)
+	echo $((end - start))
+}
+
+extents()
+{
+	filefrag "$1" 2>/dev/null | awk '{ print $2 }'
+}
+
+t_plain=$(run_shell "head -c ${SIZE_MB}M /dev/zero > $TMP/plain")
+t_pre=$(run_shell "prealloc ${SIZE_MB}M
+head -c ${SIZE_MB}M /dev/zero > $TMP/pre")
+
+printf "%-10s %8s %8s\n" "path" "GB/s" "extents"
+awk -v mb="$SIZE_MB" -v plain="$t_plain" -v pre="$t_pre" \
+	-v e_plain="$(extents "$TMP/plain")" -v e_pre="$(extents "$TMP/pre")" \
+	'BEGIN {
+	printf "%-10s %8.2f %8s\n", "plain", mb * 1.048576 / (plain / 1e6), e_plain
+	printf "%-10s %8.2f %8s\n", "prealloc", mb * 1.048576 / (pre / 1e6), e_pre
+}'
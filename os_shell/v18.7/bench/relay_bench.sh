@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+#	relay_bench.sh
+#
+#	Compares pipeline throughput of
+#		cat <file> | tee <copy> | wc -c
+#	through the default path (external /usr/bin/tee, default pipe size)
+#	and the zero-copy path (tee builtin with tee/splice, 1 MiB pipes).
+#
+#	usage: bench/relay_bench.sh [size_MiB] [shell_binary]
+#
+
+SIZE_MB=${1:-1024}
+MY_SHELL=${2:-./my_shell}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+head -c "${SIZE_MB}M" /dev/zero > "$TMP/big"
+
+now_ns()
+{
+	date +%s%N
+}
+
+# runs the command lines in $1 with my_shell, prints elapsed ns
+run_shell()
+{
+	start=$(now_ns)
+	printf '%s\n' "$1" | $MY_SHELL > /dev/null
+	end=$(now_ns)
+	echo $((end - start))
+}
+
+TEE=$(command -v tee)
+t_def=$(run_shell "cat $TMP/big | $TEE $TMP/copy | wc -c")
+t_zc=$(run_shell "pipesz 1048576
+cat $TMP/big | tee $TMP/copy | wc -c")
+
+printf "%-10s %8s\n" "path" "GB/s"
+awk -v mb="$SIZE_MB" -v def="$t_def" -v zc="$t_zc" 'BEGIN {
+	printf "%-10s %8.2f\n", "default", mb * 1.048576 / (def / 1e6)
+	printf "%-10s %8.2f\n", "zero-copy", mb * 1.048576 / (zc / 1e6)
+}'
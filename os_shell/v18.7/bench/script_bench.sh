@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+#	script_bench.sh
+#
+#	Runs a generated script of builtins (if, while, && and || around
+#	true/test) N times with my_shell, once parsing it every run (cache
+#	removed) and once from the parsed-script cache, and prints runs per
+#	second of both.
+#
+#	usage: bench/script_bench.sh [n_runs] [script_blocks] [shell_binary]
+#
+
+N=${1:-200}
+BLOCKS=${2:-2000}
+MY_SHELL=${3:-./my_shell}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+export XDG_CACHE_HOME="$TMP/cache"
+
+i=0
+while [ "$i" -lt "$BLOCKS" ]; do
+	cat <<-'EOS'
+	# a block of the script
+	if test 1 -lt 2 && [ -n "x" ]; then
+		true || echo "never printed"
+	elif false; then
+		echo "never printed either"
+	else
+		false
+	fi
+	until true; do false; done
+	EOS
+	i=$((i + 1))
+done > "$TMP/script.sh"
+
+now_ns()
+{
+	date +%s%N
+}
+
+# runs the script N times, with $1 set the cache is removed first
+run()
+{
+	start=$(now_ns)
+	j=0
+	while [ "$j" -lt "$N" ]; do
+		[ -n "$1" ] && rm -rf "$XDG_CACHE_HOME"
+		$MY_SHELL "$TMP/script.sh" > /dev/null
+		j=$((j + 1))
+	done
+	end=$(now_ns)
+	echo $((end - start))
+}
+
+t_cold=$(run cold)
+$MY_SHELL "$TMP/script.sh" > /dev/null
+t_warm=$(run)
+
+printf "%d lines\n" $(wc -l < "$TMP/script.sh")
+printf "%-8s %10s\n" "path" "runs/s"
+printf "%-8s %10d\n" "parse" $((N * 1000000000 / t_cold))
+printf "%-8s %10d\n" "cached" $((N * 1000000000 / t_warm))
@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+#	spawn_bench.sh
+#
+#	Builds my_shell with the fork and the posix_spawn (-DSPAWN) launch
+#	backends and measures how many external `/bin/true` commands per
+#	second each one runs; a bare `true` would run the builtin and launch
+#	nothing.
+#
+#	usage: bench/spawn_bench.sh [n_commands]
+#
+
+N=${1:-5000}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+gcc -Wall -O2 -o "$TMP/my_shell_fork" *.c || exit 1
+gcc -Wall -O2 -o "$TMP/my_shell_spawn" *.c -DSPAWN || exit 1
+
+i=0
+while [ "$i" -lt "$N" ]; do
+	echo /bin/true
+	i=$((i + 1))
+done > "$TMP/cmds"
+echo exit >> "$TMP/cmds"
+
+now_ns()
+{
+	date +%s%N
+}
+
+# prints elapsed ns of shell $1 running command file $2
+run_shell()
+{
+	start=$(now_ns)
+	$1 < "$2" > /dev/null 2>&1
+	end=$(now_ns)
+	echo $((end - start))
+}
+
+echo exit > "$TMP/empty"
+
+printf "%-8s %12s\n" "backend" "cmds/s"
+for backend in fork spawn; do
+	base=$(run_shell "$TMP/my_shell_$backend" "$TMP/empty")
+	t=$(( $(run_shell "$TMP/my_shell_$backend" "$TMP/cmds") - base ))
+	printf "%-8s %12d\n" "$backend" $((N * 1000000000 / t))
+done
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+#	startup_bench.sh
+#
+#	Measures exec-to-first-command latency: the average wall time of
+#	`<shell> -c true` for my_shell and /bin/sh. The cost of running
+#	/bin/true directly is reported as the floor both shells pay for
+#	the command itself.
+#
+#	usage: bench/startup_bench.sh [runs] [shell_binary]
+#
+
+RUNS=${1:-500}
+MY_SHELL=${2:-./my_shell}
+
+now_ns()
+{
+	date +%s%N
+}
+
+# prints the average ns per run of the command line in $@
+avg_ns()
+{
+	i=0
+	start=$(now_ns)
+	while [ "$i" -lt "$RUNS" ]; do
+		"$@" > /dev/null
+		i=$((i + 1))
+	done
+	end=$(now_ns)
+	echo $(((end - start) / RUNS))
+}
+
+printf "%-20s %10s\n" "command" "us/run"
+printf "%-20s %10d\n" "/bin/true" $(($(avg_ns /bin/true) / 1000))
+printf "%-20s %10d\n" "my_shell -c true" $(($(avg_ns "$MY_SHELL" -c true) / 1000))
+printf "%-20s %10d\n" "/bin/sh -c true" $(($(avg_ns /bin/sh -c true) / 1000))
@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>		/* strtoll(), strtoull() */
+#include <unistd.h>		/* getcwd(), access() */
+#include <sys/stat.h>		/* stat(), lstat() */
+
+#include "shell.h"
+
+enum builtin_id
+{
+	B_EXIT,
+	B_CLEAR,
+	B_CD,
+	B_HELP,
+	B_HASH,
+	B_PIPESZ,
+	B_JOBS,
+	B_FG,
+	B_BG,
+	B_WAIT,
+	B_PARALLEL,
+	B_STATS,
+	B_HISTORY,
+	B_PREALLOC,
+	B_TEE,
+	B_ECHO,
+	B_PRINTF,
+	B_TEST,
+	B_BRACKET,
+	B_TRUE,
+	B_FALSE,
+	B_PWD,
+	N_BUILTINS,
+};
+
+static int echo_cmd(char **parsed_args);
+static int printf_cmd(char **parsed_args);
+static int test_cmd(char **parsed_args);
+static int true_cmd(char **parsed_args);
+static int false_cmd(char **parsed_args);
+static int pwd_cmd(char **parsed_args);
+
+/* every builtin, "help" lists them in this order */
+static const struct builtin builtins[N_BUILTINS] =
+{
+	[B_EXIT]	= { "exit",	exit_cmd,	BUILTIN_SHELL },
+	[B_CLEAR]	= { "clear",	clear_cmd,	BUILTIN_SHELL },
+	[B_CD]		= { "cd",	cd_cmd,		BUILTIN_SHELL },
+	[B_HELP]	= { "help",	help_cmd,	BUILTIN_SHELL | BUILTIN_STAGE },
+	[B_HASH]	= { "hash",	hash_cmd,	BUILTIN_SHELL },
+	[B_PIPESZ]	= { "pipesz",	pipesz_cmd,	BUILTIN_SHELL },
+	[B_JOBS]	= { "jobs",	jobs_cmd,	BUILTIN_SHELL },
+	[B_FG]		= { "fg",	fg_cmd,		BUILTIN_SHELL },
+	[B_BG]		= { "bg",	bg_cmd,		BUILTIN_SHELL },
+	[B_WAIT]	= { "wait",	wait_cmd,	BUILTIN_SHELL },
+	[B_PARALLEL]	= { "parallel",	parallel_cmd,	BUILTIN_SHELL },
+	[B_STATS]	= { "stats",	stats_cmd,	BUILTIN_SHELL },
+	[B_HISTORY]	= { "history",	history_cmd,	BUILTIN_SHELL },
+	[B_PREALLOC]	= { "prealloc",	prealloc_cmd,	BUILTIN_SHELL },
+	[B_TEE]		= { "tee",	tee_cmd,	BUILTIN_STAGE },
+	[B_ECHO]	= { "echo",	echo_cmd,	BUILTIN_SHELL | BUILTIN_STAGE },
+	[B_PRINTF]	= { "printf",	printf_cmd,	BUILTIN_SHELL | BUILTIN_STAGE },
+	[B_TEST]	= { "test",	test_cmd,	BUILTIN_SHELL | BUILTIN_STAGE },
+	[B_BRACKET]	= { "[",	test_cmd,	BUILTIN_SHELL | BUILTIN_STAGE },
+	[B_TRUE]	= { "true",	true_cmd,	BUILTIN_SHELL | BUILTIN_STAGE },
+	[B_FALSE]	= { "false",	false_cmd,	BUILTIN_SHELL | BUILTIN_STAGE },
+	[B_PWD]		= { "pwd",	pwd_cmd,	BUILTIN_SHELL | BUILTIN_STAGE },
+};
+
+
+/*
+ *	builtin_find
+ *
+ *	Details:
+ *		- a switch on the first characters of name picks the only
+ *		  builtin name can be, so a lookup costs one jump and one
+ *		  strcmp however many builtins there are
+ *		- a builtin added to the table needs a case here, a name that
+ *		  shares its first characters with another one needs the
+ *		  case to look one character further
+ *
+ *	Return value
+ *		- the builtin called name, or NULL
+ */
+const struct builtin *builtin_find(const char *name)
+{
+	enum builtin_id id;
+
+	switch(name[0])
+	{
+		case '[':
+			id = B_BRACKET;
+			break;
+
+		case 'b':
+			id = B_BG;
+			break;
+
+		case 'c':
+			id = (name[1] == 'd') ? B_CD : B_CLEAR;
+			break;
+
+		case 'e':
+			id = (name[1] == 'x') ? B_EXIT : B_ECHO;
+			break;
+
+		case 'f':
+			id = (name[1] == 'g') ? B_FG : B_FALSE;
+			break;
+
+		case 'h':
+			id = (name[1] == 'e') ? B_HELP
+				: (name[1] == 'a') ? B_HASH : B_HISTORY;
+			break;
+
+		case 'j':
+			id = B_JOBS;
+			break;
+
+		case 'p':
+			switch(name[1])
+			{
+				case 'i':
+					id = B_PIPESZ;
+					break;
+
+				case 'a':
+					id = B_PARALLEL;
+					break;
+
+				case 'r':
+					id = (name[2] == 'e') ? B_PREALLOC : B_PRINTF;
+					break;
+
+				default:
+					id = B_PWD;
+					break;
+			}
+			break;
+
+		case 's':
+			id = B_STATS;
+			break;
+
+		case 't':
+			id = (name[1] == 'r') ? B_TRUE
+				: (name[1] && name[2] == 'e') ? B_TEE : B_TEST;
+			break;
+
+		case 'w':
+			id = B_WAIT;
+			break;
+
+		default:
+			return NULL;
+	}
+
+	return (strcmp(name, builtins[id].name) == 0) ? &builtins[id] : NULL;
+}
+
+
+/*
+ *	help_cmd - the "help" builtin
+ */
+int help_cmd(char **parsed_args)
+{
+	printf("available commands:\n");
+	for(int i = 0; i < N_BUILTINS; i++)
+	{
+		printf("\t %d. %s\n", i + 1, builtins[i].name);
+	}
+
+	return 0;
+}
+
+
+/*
+ *	echo_cmd - the "echo" builtin
+ *
+ *	Details:
+ *		- prints its arguments separated by blanks, "-n" leaves out
+ *		  the trailing newline
+ */
+static int echo_cmd(char **parsed_args)
+{
+	int newline = 1;
+
+	parsed_args++;
+	if(*parsed_args && strcmp(*parsed_args, "-n") == 0)
+	{
+		newline = 0;
+		parsed_args++;
+	}
+
+	for(; *parsed_args; parsed_args++)
+	{
+		fputs(*parsed_args, stdout);
+		if(parsed_args[1])
+		{
+			putchar(' ');
+		}
+	}
+	if(newline)
+	{
+		putchar('\n');
+	}
+
+	return 0;
+}
+
+
+/*
+ *	print_escape
+ *
+ *	Details:
+ *		- prints the character of the '\' escape at *s and moves *s
+ *		  past it: \n \t \r \a \b \f \v \\ and \ooo (octal)
+ *		- an unknown escape is printed as it is
+ */
+static void print_escape(const char **s)
+{
+	const char *p = *s + 1;
+	int c = *p++;
+
+	switch(c)
+	{
+		case 'n':	c = '\n';	break;
+		case 't':	c = '\t';	break;
+		case 'r':	c = '\r';	break;
+		case 'a':	c = '\a';	break;
+		case 'b':	c = '\b';	break;
+		case 'f':	c = '\f';	break;
+		case 'v':	c = '\v';	break;
+		case '\\':			break;
+
+		case '0' ... '7':
+			c -= '0';
+			for(int i = 1; i < 3 && *p >= '0' && *p <= '7'; i++)
+			{
+				c = c * 8 + *p++ - '0';
+			}
+			break;
+
+		default:
+			putchar('\\');
+			if(c == '\0')
+			{
+				p--;
+				*s = p;
+				return;
+			}
+			break;
+	}
+
+	putchar(c);
+	*s = p;
+}
+
+
+/*
+ *	printf_cmd - the "printf" builtin
+ *
+ *	Details:
+ *		- "printf format [arg...]" prints format with '\' escapes and
+ *		  the conversions %s %b %c %d %i %u %o %x %X %%, with flags,
+ *		  width and precision
+ *		- like printf(1), the format is reused until every argument
+ *		  is consumed, a missing argument is "" or 0
+ *
+ *	Return value
+ *		- 0 on success, 1 on a bad number or format
+ */
+static int printf_cmd(char **parsed_args)
+{
+	const char *format = parsed_args[1];
+	char **arg;
+	int ret = 0;
+
+	if(!format)
+	{
+		fprintf(stderr, "printf: usage: printf format [arg...]\n");
+		return 1;
+	}
+
+	arg = parsed_args + 2;
+	do
+	{
+		char **first = arg;
+
+		for(const char *s = format; *s; )
+		{
+			char spec[32];
+			const char *val;
+			size_t len;
+			char *end, *tail, conv;
+
+			if(*s == '\\')
+			{
+				print_escape(&s);
+				continue;
+			}
+			if(*s != '%')
+			{
+				putchar(*s++);
+				continue;
+			}
+			if(s[1] == '%')
+			{
+				putchar('%');
+				s += 2;
+				continue;
+			}
+
+			len = 1 + strspn(s + 1, "-+ #0");
+			len += strspn(s + len, "0123456789");
+			if(s[len] == '.')
+			{
+				len += 1 + strspn(s + len + 1, "0123456789");
+			}
+			if(!s[len] || !strchr("sbcdiuoxX", s[len])
+					|| len + 4 > sizeof(spec))
+			{
+				fprintf(stderr, "printf: %s: invalid format\n", s);
+				return 1;
+			}
+
+			val = *arg ? *arg++ : "";
+			conv = s[len];
+			memcpy(spec, s, len);
+			spec[len] = '\0';
+			if(strchr("diuoxX", conv))
+			{
+				strcat(spec, "ll");
+			}
+			tail = spec + strlen(spec);
+			tail[0] = (conv == 'b') ? 's' : conv;
+			tail[1] = '\0';
+
+			errno = 0;
+			end = "";
+			switch(conv)
+			{
+				case 's':
+					printf(spec, val);
+					break;
+
+				case 'b':
+					/* the width of %b is ignored */
+					while(*val)
+					{
+						if(*val == '\\')
+						{
+							print_escape(&val);
+						}
+						else
+						{
+							putchar(*val++);
+						}
+					}
+					break;
+
+				case 'c':
+					printf(spec, *val);
+					break;
+
+				case 'd':
+				case 'i':
+					printf(spec, *val ? strtoll(val, &end, 0) : 0LL);
+					break;
+
+				default:
+					printf(spec, *val ? strtoull(val, &end, 0) : 0ULL);
+					break;
+			}
+			if(*end || errno)
+			{
+				fprintf(stderr, "printf: %s: invalid number\n", val);
+				ret = 1;
+			}
+			s += len + 1;
+		}
+
+		if(arg == first)
+		{
+			break;
+		}
+	} while(*arg);
+
+	return ret;
+}
+
+
+/*
+ *	test_unary
+ *
+ *	Return value
+ *		- 1 if "op arg" is true, 0 if it is false, -1 if op is not a
+ *		  unary operator
+ */
+static int test_unary(const char *op, const char *arg)
+{
+	struct stat st;
+
+	if(op[0] != '-' || !op[1] || op[2])
+	{
+		return -1;
+	}
+
+	switch(op[1])
+	{
+		case 'n':
+			return *arg != '\0';
+
+		case 'z':
+			return *arg == '\0';
+
+		case 'e':
+			return stat(arg, &st) == 0;
+
+		case 'f':
+			return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+
+		case 'd':
+			return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+
+		case 'p':
+			return stat(arg, &st) == 0 && S_ISFIFO(st.st_mode);
+
+		case 's':
+			return stat(arg, &st) == 0 && st.st_size > 0;
+
+		case 'h':
+		case 'L':
+			return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+
+		case 'r':
+			return access(arg, R_OK) == 0;
+
+		case 'w':
+			return access(arg, W_OK) == 0;
+
+		case 'x':
+			return access(arg, X_OK) == 0;
+
+		case 't':
+			return isatty(atoi(arg));
+	}
+
+	return -1;
+}
+
+
+/*
+ *	test_binary
+ *
+ *	Return value
+ *		- 1 if "a op b" is true, 0 if it is false, -1 if op is not a
+ *		  binary operator, -2 if a or b is not a number
+ */
+static int test_binary(const char *a, const char *op, const char *b)
+{
+	static const char *const int_ops[] =
+		{ "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+	long long x, y;
+	char *end_a, *end_b;
+
+	if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+	{
+		return strcmp(a, b) == 0;
+	}
+	if(strcmp(op, "!=") == 0)
+	{
+		return strcmp(a, b) != 0;
+	}
+
+	for(int i = 0; i < 6; i++)
+	{
+		if(strcmp(op, int_ops[i]) != 0)
+		{
+			continue;
+		}
+
+		x = strtoll(a, &end_a, 10);
+		y = strtoll(b, &end_b, 10);
+		if(!*a || *end_a || !*b || *end_b)
+		{
+			return -2;
+		}
+
+		switch(i)
+		{
+			case 0:	return x == y;
+			case 1:	return x != y;
+			case 2:	return x < y;
+			case 3:	return x <= y;
+			case 4:	return x > y;
+			default: return x >= y;
+		}
+	}
+
+	return -1;
+}
+
+
+/*
+ *	test_cmd - the "test" and "[" builtins
+ *
+ *	Details:
+ *		- "[" needs a closing "]" as its last argument
+ *		- evaluates POSIX test with up to four arguments: "! expr",
+ *		  "string", unary file and string tests and binary string and
+ *		  integer comparisons
+ *
+ *	Return value
+ *		- 0 if the expression is true, 1 if it is false, 2 on error
+ */
+static int test_cmd(char **parsed_args)
+{
+	const char *name = parsed_args[0];
+	int argc = 0, negate = 0, r = -1;
+	char **argv = parsed_args + 1;
+
+	while(argv[argc])
+	{
+		argc++;
+	}
+
+	if(name[0] == '[')
+	{
+		if(argc == 0 || strcmp(argv[argc - 1], "]") != 0)
+		{
+			fprintf(stderr, "[: missing ']'\n");
+			return 2;
+		}
+		argc--;
+	}
+
+	if(argc > 1 && strcmp(argv[0], "!") == 0
+			&& !(argc == 3 && test_binary(argv[0], argv[1], argv[2]) != -1))
+	{
+		negate = 1;
+		argv++;
+		argc--;
+	}
+
+	switch(argc)
+	{
+		case 0:
+			r = 0;
+			break;
+
+		case 1:
+			r = (argv[0][0] != '\0');
+			break;
+
+		case 2:
+			r = test_unary(argv[0], argv[1]);
+			break;
+
+		case 3:
+			r = test_binary(argv[0], argv[1], argv[2]);
+			break;
+	}
+
+	if(r == -2)
+	{
+		fprintf(stderr, "%s: integer expression expected\n", name);
+		return 2;
+	}
+	if(r < 0)
+	{
+		fprintf(stderr, "%s: unsupported expression\n", name);
+		return 2;
+	}
+
+	return (r ^ negate) ? 0 : 1;
+}
+
+
+static int true_cmd(char **parsed_args)
+{
+	return 0;
+}
+
+static int false_cmd(char **parsed_args)
+{
+	return 1;
+}
+
+
+/*
+ *	pwd_cmd - the "pwd" builtin
+ */
+static int pwd_cmd(char **parsed_args)
+{
+	char *cwd = getcwd(NULL, 0);
+
+	if(!cwd)
+	{
+		fprintf(stderr, "pwd: %s\n", strerror(errno));
+		return 1;
+	}
+
+	puts(cwd);
+	free(cwd);
+	return 0;
+}
@@ -0,0 +1,640 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>		/* qsort_r(), getenv() */
+#include <fcntl.h>		/* open() */
+#include <sys/mman.h>		/* mmap() */
+#include <sys/stat.h>		/* fstat() */
+#include <sys/uio.h>		/* writev() */
+
+#include "shell.h"
+
+/*
+ *	struct history - the history file and its prefix index
+ *
+ *	@fd	: history file, opened with O_APPEND, -1 if there is none
+ *	@map	: read-only shared mapping of the file, NULL until the first
+ *		  lookup
+ *	@map_len: bytes mapped
+ *	@end	: end of the last complete line of the mapping, everything
+ *		  before it is indexed
+ *	@idx	: offset of the newest copy of every distinct line, sorted by
+ *		  the text of the line
+ *	@n_idx	: entries in idx
+ *	@cap	: entries allocated for idx
+ *	@last	: last line added by this session, to skip repeats
+ */
+static struct
+{
+	int fd;
+	const char *map;
+	size_t map_len;
+	size_t end;
+	size_t *idx;
+	size_t n_idx;
+	size_t cap;
+	char *last;
+} hist = { -1 };
+
+
+/*
+ *	history_init
+ *
+ *	Details:
+ *		- opens $HISTFILE, or ~/HISTORY_FILE, for appending; the file
+ *		  is shared by every running shell
+ *		- called at startup of an interactive shell only
+ *		- nothing is read here, the file is mapped and indexed on the
+ *		  first lookup, so startup does not depend on its size
+ */
+void history_init(void)
+{
+	const char *path = getenv("HISTFILE");
+	char *buf = NULL;
+
+	if(!path || !*path)
+	{
+		const char *home = getenv("HOME");
+
+		if(!home || asprintf(&buf, "%s/%s", home, HISTORY_FILE) < 0)
+		{
+			return;
+		}
+		path = buf;
+	}
+
+	hist.fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	free(buf);
+}
+
+
+/*
+ *	line_cmp - compares two '\n' terminated lines of the mapping
+ */
+static int line_cmp(const char *a, const char *b)
+{
+	while(*a == *b && *a != '\n')
+	{
+		a++;
+		b++;
+	}
+
+	return (unsigned char)(*a == '\n' ? 0 : *a)
+			- (unsigned char)(*b == '\n' ? 0 : *b);
+}
+
+
+/*
+ *	prefix_cmp - compares the start of a line of the mapping with prefix
+ *
+ *	Return value
+ *		- 0 if the line starts with prefix, otherwise the order of the
+ *		  line relative to prefix
+ */
+static int prefix_cmp(const char *line, const char *prefix, size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+	{
+		unsigned char c = (line[i] == '\n') ? 0 : line[i];
+
+		if(c != (unsigned char)prefix[i])
+		{
+			return c - (unsigned char)prefix[i];
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ *	offset_cmp - qsort_r order of idx, by the text of the lines
+ */
+static int offset_cmp(const void *a, const void *b, void *map)
+{
+	return line_cmp((const char *)map + *(const size_t *)a,
+			(const char *)map + *(const size_t *)b);
+}
+
+
+/*
+ *	hash_line - FNV-1a hash of a line of the mapping
+ */
+static unsigned int hash_line(const char *line)
+{
+	unsigned int h = 2166136261u;
+
+	while(*line != '\n')
+	{
+		h ^= (unsigned char)*line++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+
+/*
+ *	index_dedup
+ *
+ *	Details:
+ *		- keeps only the newest copy of every line in idx, through an
+ *		  open addressing hash table of offsets
+ *		- histories repeat the same lines a lot, so the sort that
+ *		  follows has far fewer lines to order
+ *
+ *	Return value
+ *		- 0 on success, -1 if out of memory
+ */
+static int index_dedup(void)
+{
+	size_t size = 16, n = 0;
+	size_t *table;
+
+	while(size < 2 * hist.n_idx)
+	{
+		size *= 2;
+	}
+	/* slots hold offset + 1, 0 is free */
+	table = calloc(size, sizeof(*table));
+	if(!table)
+	{
+		return -1;
+	}
+
+	for(size_t i = 0; i < hist.n_idx; i++)
+	{
+		size_t off = hist.idx[i];
+		size_t h = hash_line(hist.map + off) & (size - 1);
+
+		while(table[h] && line_cmp(hist.map + table[h] - 1,
+				hist.map + off) != 0)
+		{
+			h = (h + 1) & (size - 1);
+		}
+		if(table[h] <= off)
+		{
+			table[h] = off + 1;
+		}
+	}
+
+	for(size_t h = 0; h < size; h++)
+	{
+		if(table[h])
+		{
+			hist.idx[n++] = table[h] - 1;
+		}
+	}
+	hist.n_idx = n;
+	free(table);
+
+	return 0;
+}
+
+
+/*
+ *	index_insert
+ *
+ *	Details:
+ *		- puts the line at off into idx, replacing an older copy of
+ *		  the same line; idx must have room for one more entry
+ */
+static void index_insert(size_t off)
+{
+	size_t lo = 0, hi = hist.n_idx;
+
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if(line_cmp(hist.map + hist.idx[mid], hist.map + off) < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	if(lo < hist.n_idx && line_cmp(hist.map + hist.idx[lo],
+			hist.map + off) == 0)
+	{
+		hist.idx[lo] = off;
+		return;
+	}
+
+	memmove(hist.idx + lo + 1, hist.idx + lo,
+			(hist.n_idx - lo) * sizeof(*hist.idx));
+	hist.idx[lo] = off;
+	hist.n_idx++;
+}
+
+
+/*
+ *	history_sync
+ *
+ *	Details:
+ *		- maps lines appended to the file (by any shell) since the last
+ *		  lookup and adds them to the index
+ *		- a few new lines are inserted one by one; on the first lookup,
+ *		  or with more than HISTORY_INSERT_MAX new lines, the index is
+ *		  deduplicated (newest copy of every line) and sorted again
+ *		- a line still being written (no '\n' yet) is left for later
+ *		- a file that shrank (truncated by another shell or by hand)
+ *		  is mapped and indexed again from the start, the old mapping
+ *		  reaches past its end and would fault
+ *
+ *	Return value
+ *		- 0 on success, -1 without a history file or out of memory
+ */
+static int history_sync(void)
+{
+	struct stat st;
+	const char *nl;
+	size_t n_new = 0, first;
+
+	if(hist.fd < 0 || fstat(hist.fd, &st) < 0)
+	{
+		return -1;
+	}
+
+	if((size_t)st.st_size < hist.map_len)
+	{
+		munmap((void *)hist.map, hist.map_len);
+		hist.map = NULL;
+		hist.map_len = 0;
+		hist.end = 0;
+		hist.n_idx = 0;
+	}
+	first = hist.n_idx;
+
+	if((size_t)st.st_size > hist.map_len)
+	{
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+				hist.fd, 0);
+
+		if(map == MAP_FAILED)
+		{
+			return -1;
+		}
+		if(hist.map)
+		{
+			munmap((void *)hist.map, hist.map_len);
+		}
+		hist.map = map;
+		hist.map_len = st.st_size;
+	}
+
+	if(hist.map_len == hist.end)
+	{
+		return 0;
+	}
+	nl = memrchr(hist.map + hist.end, '\n', hist.map_len - hist.end);
+	if(!nl)
+	{
+		return 0;
+	}
+
+	for(const char *p = hist.map + hist.end; p <= nl; p++)
+	{
+		n_new += (*p == '\n');
+	}
+
+	if(hist.n_idx + n_new > hist.cap)
+	{
+		size_t cap = hist.cap ? hist.cap : 1024;
+		size_t *idx;
+
+		while(cap < hist.n_idx + n_new)
+		{
+			cap *= 2;
+		}
+		idx = realloc(hist.idx, cap * sizeof(*idx));
+		if(!idx)
+		{
+			return -1;
+		}
+		hist.idx = idx;
+		hist.cap = cap;
+	}
+
+	for(const char *p = hist.map + hist.end; p <= nl; )
+	{
+		const char *eol = memchr(p, '\n', nl - p + 1);
+
+		if(n_new > HISTORY_INSERT_MAX || first == 0)
+		{
+			hist.idx[hist.n_idx++] = p - hist.map;
+		}
+		else
+		{
+			index_insert(p - hist.map);
+		}
+		p = eol + 1;
+	}
+	hist.end = nl + 1 - hist.map;
+
+	if(n_new > HISTORY_INSERT_MAX || first == 0)
+	{
+		if(index_dedup() < 0)
+		{
+			return -1;
+		}
+		qsort_r(hist.idx, hist.n_idx, sizeof(*hist.idx), offset_cmp,
+				(void *)hist.map);
+	}
+
+	return 0;
+}
+
+
+/*
+ *	prefix_range
+ *
+ *	Details:
+ *		- binary searches idx for the lines starting with prefix, they
+ *		  are idx[*lo] up to idx[*hi - 1]
+ */
+static void prefix_range(const char *prefix, size_t *lo, size_t *hi)
+{
+	size_t len = strlen(prefix), l = 0, h = hist.n_idx;
+
+	while(l < h)
+	{
+		size_t mid = l + (h - l) / 2;
+
+		if(prefix_cmp(hist.map + hist.idx[mid], prefix, len) < 0)
+		{
+			l = mid + 1;
+		}
+		else
+		{
+			h = mid;
+		}
+	}
+	*lo = l;
+
+	h = hist.n_idx;
+	while(l < h)
+	{
+		size_t mid = l + (h - l) / 2;
+
+		if(prefix_cmp(hist.map + hist.idx[mid], prefix, len) == 0)
+		{
+			l = mid + 1;
+		}
+		else
+		{
+			h = mid;
+		}
+	}
+	*hi = l;
+}
+
+
+/*
+ *	line_before
+ *
+ *	Return value
+ *		- offset of the line ending just before off
+ */
+static size_t line_before(size_t off)
+{
+	const char *nl;
+
+	if(off < 2)
+	{
+		return 0;
+	}
+	nl = memrchr(hist.map, '\n', off - 1);
+	return nl ? nl + 1 - hist.map : 0;
+}
+
+
+/*
+ *	print_line
+ */
+static void print_line(size_t off)
+{
+	const char *line = hist.map + off;
+
+	fwrite(line, 1, strchrnul(line, '\n') - line, stdout);
+	putchar('\n');
+}
+
+
+/*
+ *	history_find
+ *
+ *	Details:
+ *		- finds the newest line starting with prefix, "" matches the
+ *		  last line of the file
+ *
+ *	Return value
+ *		- offset of the line in the mapping, or -1 if there is none
+ */
+static ssize_t history_find(const char *prefix)
+{
+	size_t lo, hi, best;
+
+	if(history_sync() < 0 || hist.end == 0)
+	{
+		return -1;
+	}
+
+	if(!*prefix)
+	{
+		return line_before(hist.end);
+	}
+
+	prefix_range(prefix, &lo, &hi);
+	if(lo == hi)
+	{
+		return -1;
+	}
+
+	best = hist.idx[lo];
+	for(size_t i = lo + 1; i < hi; i++)
+	{
+		best = (hist.idx[i] > best) ? hist.idx[i] : best;
+	}
+	return best;
+}
+
+
+/*
+ *	history_expand
+ *
+ *	Details:
+ *		- a line "!prefix" is replaced by the newest history line that
+ *		  starts with prefix, "!!" by the last line of the history;
+ *		  the replacement is echoed like in other shells
+ *		- any other line is returned unchanged
+ *
+ *	Return value
+ *		- the line to run, it stays valid until the next call
+ *		- NULL if no history line matches
+ */
+char *history_expand(char *line)
+{
+	static char *buf;
+	char *prefix = line + strspn(line, " \t");
+	size_t len;
+	ssize_t off;
+
+	if(prefix[0] != '!' || prefix[1] == '\0' || prefix[1] == '\n'
+			|| prefix[1] == ' ')
+	{
+		return line;
+	}
+
+	prefix++;
+	prefix[strcspn(prefix, "\n")] = '\0';
+	off = history_find(strcmp(prefix, "!") == 0 ? "" : prefix);
+	if(off < 0)
+	{
+		fprintf(stderr, "!%s: event not found\n", prefix);
+		return NULL;
+	}
+
+	len = strchrnul(hist.map + off, '\n') - (hist.map + off);
+	free(buf);
+	buf = malloc(len + 2);
+	if(!buf)
+	{
+		return NULL;
+	}
+	memcpy(buf, hist.map + off, len);
+	strcpy(buf + len, "\n");
+
+	fputs(buf, stdout);
+	return buf;
+}
+
+
+/*
+ *	history_add
+ *
+ *	Details:
+ *		- appends line to the history file with one write, so lines of
+ *		  concurrent shells never interleave
+ *		- blank lines and repeats of the previous line are skipped
+ */
+void history_add(const char *line)
+{
+	size_t len;
+	struct iovec iov[2];
+
+	line += strspn(line, " \t");
+	len = strcspn(line, "\n");
+	if(hist.fd < 0 || len == 0)
+	{
+		return;
+	}
+
+	if(hist.last && strncmp(hist.last, line, len) == 0
+			&& hist.last[len] == '\0')
+	{
+		return;
+	}
+	free(hist.last);
+	hist.last = strndup(line, len);
+
+	iov[0].iov_base = (void *)line;
+	iov[0].iov_len = len;
+	iov[1].iov_base = "\n";
+	iov[1].iov_len = 1;
+	if(writev(hist.fd, iov, 2) < 0)
+	{
+		fprintf(stderr, "history: %s\n", strerror(errno));
+	}
+}
+
+
+/*
+ *	offset_desc - qsort order of offsets, newest first
+ */
+static int offset_desc(const void *a, const void *b)
+{
+	size_t x = *(const size_t *)a, y = *(const size_t *)b;
+
+	return (x < y) - (x > y);
+}
+
+
+/*
+ *	history_cmd - the "history" builtin
+ *
+ *	Details:
+ *		- "history [-n count] [prefix]" prints the last count lines of
+ *		  the history (default HISTORY_SHOW), oldest first
+ *		- with a prefix, it prints the newest count distinct lines that
+ *		  start with it, found through the prefix index
+ *		- a batch shell opens the history file here, on first use
+ *
+ *	Return value
+ *		- 0 on success, 1 without a history file
+ */
+int history_cmd(char **parsed_args)
+{
+	size_t count = HISTORY_SHOW, lo, hi, n;
+	const char *prefix = "";
+	size_t *found;
+
+	parsed_args++;
+	if(*parsed_args && strcmp(*parsed_args, "-n") == 0 && parsed_args[1])
+	{
+		count = strtoul(parsed_args[1], NULL, 10);
+		parsed_args += 2;
+	}
+	if(*parsed_args)
+	{
+		prefix = *parsed_args;
+	}
+
+	if(hist.fd < 0)
+	{
+		history_init();
+	}
+	if(history_sync() < 0)
+	{
+		fprintf(stderr, "history: no history file\n");
+		return 1;
+	}
+
+	if(!*prefix)
+	{
+		size_t off = hist.end;
+
+		for(n = 0; n < count && off > 0; n++)
+		{
+			off = line_before(off);
+		}
+		while(off < hist.end)
+		{
+			print_line(off);
+			off = strchrnul(hist.map + off, '\n') + 1 - hist.map;
+		}
+		return 0;
+	}
+
+	prefix_range(prefix, &lo, &hi);
+	n = hi - lo;
+	found = malloc(n * sizeof(*found) + 1);
+	if(!found)
+	{
+		return 1;
+	}
+	memcpy(found, hist.idx + lo, n * sizeof(*found));
+	qsort(found, n, sizeof(*found), offset_desc);
+
+	for(size_t i = (n < count) ? n : count; i > 0; i--)
+	{
+		print_line(found[i - 1]);
+	}
+	free(found);
+
+	return 0;
+}
@@ -0,0 +1,761 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>		/* malloc(), strtol() */
+#include <unistd.h>		/* tcsetpgrp(), setpgid() */
+#include <signal.h>		/* sigaction(), sigsuspend() */
+#include <termios.h>		/* tcgetattr(), tcsetattr() */
+#include <sys/wait.h>		/* wait4() */
+#include <sys/signalfd.h>	/* signalfd() */
+
+#include "shell.h"
+
+/* every job started and not yet reported done, newest first */
+static struct job *job_list;
+
+/* set when the shell owns a terminal and runs jobs in their own groups */
+static int job_control;
+static pid_t shell_pgid;
+static struct termios shell_tmodes;
+
+/* SIGCHLD as a descriptor for the input loop of an interactive shell */
+static int sigchld_fd = -1;
+
+
+/*
+ *	reap_children
+ *
+ *	Details:
+ *		- reaps every child that changed state with wait4 and records
+ *		  the new state and, once done, the resource usage of the child
+ *		  in the job table
+ *		- runs in the SIGCHLD handler, or from jobs_event while the
+ *		  signal is blocked and read from sigchld_fd instead
+ */
+static void reap_children(void)
+{
+	struct rusage ru;
+	int status;
+	pid_t pid;
+
+	while((pid = wait4(-1, &status,
+			WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0)
+	{
+		for(struct job *j = job_list; j; j = j->next)
+		{
+			for(int i = 0; i < j->n_procs; i++)
+			{
+				struct process *p = &j->procs[i];
+
+				if(p->pid != pid)
+				{
+					continue;
+				}
+
+				if(WIFSTOPPED(status))
+				{
+					p->state = PROC_STOPPED;
+				}
+				else if(WIFCONTINUED(status))
+				{
+					p->state = PROC_RUNNING;
+				}
+				else
+				{
+					p->state = PROC_DONE;
+					p->status = status;
+					p->ru = ru;
+					if(p->start_ns)
+					{
+						p->end_ns = clock_ns();
+					}
+				}
+			}
+		}
+	}
+}
+
+
+/*
+ *	sigchld_handler
+ *
+ *	Details:
+ *		- the job table is only modified with SIGCHLD blocked, so the
+ *		  handler always sees it in a consistent state
+ */
+static void sigchld_handler(int sig)
+{
+	int saved_errno = errno;
+
+	reap_children();
+	errno = saved_errno;
+}
+
+
+/*
+ *	jobs_init
+ *
+ *	Details:
+ *		- installs the SIGCHLD handler
+ *		- on a terminal, waits until the shell is in the foreground,
+ *		  puts it in its own process group, takes the terminal and
+ *		  ignores the job control signals
+ *		- an interactive shell also gets a signalfd for SIGCHLD, which
+ *		  it polls together with its input (jobs_event)
+ */
+void jobs_init(int interactive)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigchld_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	if(!interactive)
+	{
+		return;
+	}
+
+	while(tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+	{
+		kill(-shell_pgid, SIGTTIN);
+	}
+
+	signal(SIGINT, SIG_IGN);
+	signal(SIGQUIT, SIG_IGN);
+	signal(SIGTSTP, SIG_IGN);
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+
+	/* fails with EPERM if the shell already leads its session */
+	shell_pgid = getpid();
+	setpgid(shell_pgid, shell_pgid);
+	shell_pgid = getpgrp();
+
+	tcsetpgrp(STDIN_FILENO, shell_pgid);
+	tcgetattr(STDIN_FILENO, &shell_tmodes);
+	job_control = 1;
+
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGCHLD);
+	sigchld_fd = signalfd(-1, &sa.sa_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+
+/*
+ *	sigchld_block / sigchld_restore
+ *
+ *	Details:
+ *		- bracket every access to the job table, old receives the mask
+ *		  to restore
+ */
+void sigchld_block(sigset_t *old)
+{
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &set, old);
+}
+
+void sigchld_restore(const sigset_t *old)
+{
+	sigprocmask(SIG_SETMASK, old, NULL);
+}
+
+
+/*
+ *	child_reset_signals
+ *
+ *	Details:
+ *		- called in a forked child, restores default dispositions of the
+ *		  signals the shell ignores or handles and unblocks everything
+ */
+void child_reset_signals(void)
+{
+	sigset_t none;
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGTTIN, SIG_DFL);
+	signal(SIGTTOU, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+
+/*
+ *	job_create
+ *
+ *	Details:
+ *		- allocates a job for a pipeline of n_stages, with room for
+ *		  n_procs processes, and links it into the job table; SIGCHLD
+ *		  must be blocked
+ *		- the job, its process array and its text are one allocation
+ *
+ *	Return value
+ *		- the job, or NULL if out of memory
+ */
+struct job *job_create(char ***stages, int n_stages, int n_procs,
+		int background)
+{
+	size_t len = background ? 3 : 1;
+	struct job *job;
+	char *t;
+	int id = 0;
+
+	for(int s = 0; s < n_stages; s++)
+	{
+		for(char **a = stages[s]; *a; a++)
+		{
+			len += strlen(*a) + 1;
+		}
+		len += 2;
+	}
+
+	job = malloc(sizeof(*job) + n_procs * sizeof(struct process) + len);
+	if(!job)
+	{
+		return NULL;
+	}
+
+	for(struct job *j = job_list; j; j = j->next)
+	{
+		id = (j->id > id) ? j->id : id;
+	}
+
+	job->id = id + 1;
+	job->pgid = 0;
+	job->n_procs = 0;
+	job->procs = (struct process *)(job + 1);
+	job->text = (char *)(job->procs + n_procs);
+	job->has_tmodes = 0;
+
+	t = job->text;
+	for(int s = 0; s < n_stages; s++)
+	{
+		if(s > 0)
+		{
+			t = stpcpy(t, "| ");
+		}
+		for(char **a = stages[s]; *a; a++)
+		{
+			t = stpcpy(t, *a);
+			*t++ = ' ';
+		}
+	}
+	if(background)
+	{
+		*t++ = '&';
+	}
+	else if(t > job->text)
+	{
+		t--;
+	}
+	*t = '\0';
+
+	job->next = job_list;
+	job_list = job;
+	return job;
+}
+
+
+/*
+ *	job_add_process
+ *
+ *	Details:
+ *		- records a started process of the job, SIGCHLD must be blocked
+ *		- with job control the first process leads the process group of
+ *		  the job; setpgid is repeated here since the parent cannot know
+ *		  whether the child already ran its own setpgid
+ */
+void job_add_process(struct job *job, pid_t pid)
+{
+	struct process *p = &job->procs[job->n_procs++];
+
+	p->pid = pid;
+	p->state = PROC_RUNNING;
+	p->status = 0;
+	p->start_ns = stats_timing ? clock_ns() : 0;
+
+	if(job_control)
+	{
+		if(!job->pgid)
+		{
+			job->pgid = pid;
+		}
+		setpgid(pid, job->pgid);
+	}
+}
+
+
+/*
+ *	job_launch_pgid
+ *
+ *	Return value
+ *		- process group the next process of job has to join (0 for a
+ *		  new group), or -1 if job control is off
+ */
+pid_t job_launch_pgid(struct job *job)
+{
+	return job_control ? job->pgid : -1;
+}
+
+
+/*
+ *	job_is_done / job_is_stopped
+ */
+static int job_is_done(struct job *job)
+{
+	for(int i = 0; i < job->n_procs; i++)
+	{
+		if(job->procs[i].state != PROC_DONE)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int job_is_stopped(struct job *job)
+{
+	int stopped = 0;
+
+	for(int i = 0; i < job->n_procs; i++)
+	{
+		if(job->procs[i].state == PROC_RUNNING)
+		{
+			return 0;
+		}
+		stopped |= (job->procs[i].state == PROC_STOPPED);
+	}
+
+	return stopped;
+}
+
+
+/*
+ *	job_status
+ *
+ *	Return value
+ *		- exit status of the last process of the job
+ */
+static int job_status(struct job *job)
+{
+	if(job->n_procs == 0)
+	{
+		return 127;
+	}
+
+	return wait_status(job->procs[job->n_procs - 1].status);
+}
+
+
+/*
+ *	job_discard
+ *
+ *	Details:
+ *		- unlinks and frees job, SIGCHLD must be blocked
+ *		- hands the timed processes of the job to stats.c first
+ */
+void job_discard(struct job *job)
+{
+	stats_job_done(job);
+
+	for(struct job **pj = &job_list; *pj; pj = &(*pj)->next)
+	{
+		if(*pj == job)
+		{
+			*pj = job->next;
+			free(job);
+			return;
+		}
+	}
+}
+
+
+/*
+ *	job_wait
+ *
+ *	Details:
+ *		- sleeps in sigsuspend until every process of job is done or,
+ *		  with job control, the job is stopped
+ *		- SIGCHLD must be blocked, old is the mask to suspend with
+ *		- after a foreground job the shell takes the terminal back, the
+ *		  terminal modes of a stopped job are kept for "fg"
+ *		- a done job is removed from the job table
+ *
+ *	Return value
+ *		- exit status of the job, 128 + SIGTSTP if it was stopped
+ */
+int job_wait(struct job *job, int foreground, const sigset_t *old)
+{
+	int status;
+
+	while(!job_is_done(job) && !(job_control && job_is_stopped(job)))
+	{
+		sigsuspend(old);
+	}
+
+	if(foreground && job_control)
+	{
+		tcsetpgrp(STDIN_FILENO, shell_pgid);
+		if(!job_is_done(job))
+		{
+			tcgetattr(STDIN_FILENO, &job->tmodes);
+			job->has_tmodes = 1;
+		}
+		tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+	}
+
+	if(!job_is_done(job))
+	{
+		printf("\n[%d]+  Stopped\t\t%s\n", job->id, job->text);
+		return 128 + SIGTSTP;
+	}
+
+	status = job_status(job);
+	if(foreground && job_control && status == 128 + SIGINT)
+	{
+		printf("\n");
+	}
+	job_discard(job);
+	return status;
+}
+
+
+/*
+ *	job_state_name
+ */
+static const char *job_state_name(struct job *job)
+{
+	int status;
+
+	if(!job_is_done(job))
+	{
+		return job_is_stopped(job) ? "Stopped" : "Running";
+	}
+
+	status = job->procs[job->n_procs - 1].status;
+	if(WIFSIGNALED(status))
+	{
+		return strsignal(WTERMSIG(status));
+	}
+
+	return WEXITSTATUS(status) ? "Exit" : "Done";
+}
+
+
+/*
+ *	jobs_event_fd
+ *
+ *	Return value
+ *		- a descriptor that becomes readable when a child changes state
+ *		  while SIGCHLD is blocked, -1 if the shell is not interactive
+ */
+int jobs_event_fd(void)
+{
+	return sigchld_fd;
+}
+
+
+/*
+ *	jobs_event
+ *
+ *	Details:
+ *		- called with SIGCHLD blocked when jobs_event_fd is readable,
+ *		  drains it and reaps the children it reported
+ *
+ *	Return value
+ *		- number of jobs that are done and not yet reported
+ */
+int jobs_event(void)
+{
+	struct signalfd_siginfo si;
+	int n = 0;
+
+	while(read(sigchld_fd, &si, sizeof(si)) == sizeof(si))
+	{
+	}
+	reap_children();
+
+	for(struct job *j = job_list; j; j = j->next)
+	{
+		n += job_is_done(j);
+	}
+	return n;
+}
+
+
+/*
+ *	jobs_notify
+ *
+ *	Details:
+ *		- removes background jobs that finished since the last call
+ *		- verbose (interactive shells) reports each of them
+ */
+void jobs_notify(int verbose)
+{
+	struct job *j, *next;
+	sigset_t old;
+
+	sigchld_block(&old);
+	for(j = job_list; j; j = next)
+	{
+		next = j->next;
+		if(job_is_done(j))
+		{
+			if(verbose)
+			{
+				printf("[%d]+  %s\t\t%s\n", j->id,
+						job_state_name(j), j->text);
+			}
+			job_discard(j);
+		}
+	}
+	sigchld_restore(&old);
+}
+
+
+/*
+ *	find_job
+ *
+ *	Details:
+ *		- resolves "%n", "n" or a pid of one of the processes; NULL spec
+ *		  means the most recent job
+ *
+ *	Return value
+ *		- the job, or NULL if there is no such job
+ */
+static struct job *find_job(const char *spec)
+{
+	long n;
+
+	if(!spec)
+	{
+		return job_list;
+	}
+
+	if(spec[0] == '%')
+	{
+		if(spec[1] == '+' || spec[1] == '%' || spec[1] == '\0')
+		{
+			return job_list;
+		}
+		n = strtol(spec + 1, NULL, 10);
+		for(struct job *j = job_list; j; j = j->next)
+		{
+			if(j->id == n)
+			{
+				return j;
+			}
+		}
+		return NULL;
+	}
+
+	n = strtol(spec, NULL, 10);
+	for(struct job *j = job_list; j; j = j->next)
+	{
+		for(int i = 0; i < j->n_procs; i++)
+		{
+			if(j->procs[i].pid == n)
+			{
+				return j;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ *	job_continue
+ *
+ *	Details:
+ *		- marks every live process of job running and sends SIGCONT to
+ *		  its process group (or each process without job control)
+ */
+static void job_continue(struct job *job)
+{
+	for(int i = 0; i < job->n_procs; i++)
+	{
+		if(job->procs[i].state != PROC_DONE)
+		{
+			job->procs[i].state = PROC_RUNNING;
+			if(!job_control)
+			{
+				kill(job->procs[i].pid, SIGCONT);
+			}
+		}
+	}
+
+	if(job_control)
+	{
+		kill(-job->pgid, SIGCONT);
+	}
+}
+
+
+/*
+ *	jobs_cmd - the "jobs" builtin
+ *
+ *	Details:
+ *		- lists every job with its state, finished jobs are then removed
+ */
+int jobs_cmd(char **parsed_args)
+{
+	sigset_t old;
+	int n = 0;
+
+	sigchld_block(&old);
+	for(struct job *j = job_list; j; j = j->next)
+	{
+		n++;
+	}
+
+	/* oldest first */
+	for(int k = n; k > 0; k--)
+	{
+		struct job *j = job_list;
+
+		for(int i = 1; i < k; i++)
+		{
+			j = j->next;
+		}
+		printf("[%d]%c  %-24s%s\n", j->id, (k == 1) ? '+' : ' ',
+				job_state_name(j), j->text);
+	}
+	sigchld_restore(&old);
+
+	jobs_notify(0);
+	return 0;
+}
+
+
+/*
+ *	fg_cmd - the "fg" builtin
+ *
+ *	Details:
+ *		- "fg [job]" continues job in the foreground and waits for it
+ */
+int fg_cmd(char **parsed_args)
+{
+	struct job *job;
+	sigset_t old;
+	int status;
+
+	sigchld_block(&old);
+	job = find_job(parsed_args[1]);
+	if(!job)
+	{
+		sigchld_restore(&old);
+		fprintf(stderr, "fg: %s: no such job\n",
+				parsed_args[1] ? parsed_args[1] : "current");
+		return 1;
+	}
+
+	printf("%s\n", job->text);
+	fflush(stdout);
+	if(job_control)
+	{
+		tcsetpgrp(STDIN_FILENO, job->pgid);
+		if(job->has_tmodes)
+		{
+			tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+		}
+	}
+	job_continue(job);
+
+	status = job_wait(job, 1, &old);
+	sigchld_restore(&old);
+	return status;
+}
+
+
+/*
+ *	bg_cmd - the "bg" builtin
+ *
+ *	Details:
+ *		- "bg [job]" continues a stopped job in the background
+ */
+int bg_cmd(char **parsed_args)
+{
+	struct job *job;
+	sigset_t old;
+
+	sigchld_block(&old);
+	job = find_job(parsed_args[1]);
+	if(!job)
+	{
+		sigchld_restore(&old);
+		fprintf(stderr, "bg: %s: no such job\n",
+				parsed_args[1] ? parsed_args[1] : "current");
+		return 1;
+	}
+
+	job_continue(job);
+	printf("[%d]+ %s &\n", job->id, job->text);
+	sigchld_restore(&old);
+	return 0;
+}
+
+
+/*
+ *	wait_cmd - the "wait" builtin
+ *
+ *	Details:
+ *		- "wait" waits until no background job is running
+ *		- "wait job..." waits for each job (%n or pid)
+ *
+ *	Return value
+ *		- status of the last job waited for, 0 without arguments,
+ *		  127 if a job does not exist
+ */
+int wait_cmd(char **parsed_args)
+{
+	sigset_t old;
+	int status = 0;
+
+	sigchld_block(&old);
+	if(!parsed_args[1])
+	{
+		int running = 1;
+
+		while(running)
+		{
+			running = 0;
+			for(struct job *j = job_list; j; j = j->next)
+			{
+				running |= !job_is_done(j) && !job_is_stopped(j);
+			}
+			if(running)
+			{
+				sigsuspend(&old);
+			}
+		}
+	}
+
+	for(int i = 1; parsed_args[i]; i++)
+	{
+		struct job *job = find_job(parsed_args[i]);
+
+		if(!job)
+		{
+			fprintf(stderr, "wait: %s: no such job\n", parsed_args[i]);
+			status = 127;
+			continue;
+		}
+		status = job_wait(job, 0, &old);
+	}
+	sigchld_restore(&old);
+
+	return status;
+}
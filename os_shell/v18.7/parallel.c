@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>		/* malloc(), strtol() */
+#include <unistd.h>		/* sysconf(), read(), write() */
+#include <fcntl.h>		/* open() */
+#include <signal.h>		/* sigsuspend() */
+#include <time.h>		/* clock_gettime() */
+#include <sys/mman.h>		/* memfd_create() */
+#include <sys/sendfile.h>	/* sendfile() */
+#include <sys/wait.h>		/* WIFSIGNALED() */
+
+#include "shell.h"
+
+
+/*
+ *	struct par_item - one input of a "parallel" run
+ *
+ *	@arg	: the input
+ *	@out_fd	: memfd capturing the stdout of its command, -1 once emitted
+ *	@proc	: index of its process in the job, -1 if it failed to start
+ */
+struct par_item
+{
+	char *arg;
+	int out_fd;
+	int proc;
+};
+
+
+/*
+ *	read_items
+ *
+ *	Details:
+ *		- reads one input per line of stdin, until end of file
+ *
+ *	Return value
+ *		- number of inputs stored in *items, -1 if out of memory
+ */
+static int read_items(struct par_item **items)
+{
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+	int n_items = 0, cap = 0;
+
+	*items = NULL;
+	while((n = getline(&line, &len, stdin)) >= 0)
+	{
+		if(n > 0 && line[n - 1] == '\n')
+		{
+			line[--n] = '\0';
+		}
+
+		if(n_items == cap)
+		{
+			struct par_item *p;
+
+			cap = cap ? 2 * cap : 64;
+			p = realloc(*items, cap * sizeof(**items));
+			if(!p)
+			{
+				free(line);
+				return -1;
+			}
+			*items = p;
+		}
+		(*items)[n_items++].arg = strdup(line);
+	}
+	clearerr(stdin);
+	free(line);
+
+	return n_items;
+}
+
+
+/*
+ *	build_argv
+ *
+ *	Details:
+ *		- copies cmd into argv, every "{}" in an argument is replaced by
+ *		  arg; if no argument holds "{}", arg is appended instead
+ *		- replaced arguments are malloc'ed, argv[i] != cmd[i] tells
+ *		  which ones to free
+ */
+static void build_argv(char **cmd, int n_cmd, const char *arg, char **argv)
+{
+	size_t arg_len = strlen(arg);
+	int replaced = 0;
+
+	for(int i = 0; i < n_cmd; i++)
+	{
+		const char *s = cmd[i], *hit;
+		size_t n = 0;
+		char *d;
+
+		argv[i] = cmd[i];
+		for(hit = strstr(s, "{}"); hit; hit = strstr(hit + 2, "{}"))
+		{
+			n++;
+		}
+		if(n == 0)
+		{
+			continue;
+		}
+
+		d = argv[i] = malloc(strlen(s) + n * arg_len + 1);
+		if(!d)
+		{
+			argv[i] = cmd[i];
+			continue;
+		}
+		while((hit = strstr(s, "{}")))
+		{
+			d = mempcpy(d, s, hit - s);
+			d = mempcpy(d, arg, arg_len);
+			s = hit + 2;
+		}
+		strcpy(d, s);
+		replaced = 1;
+	}
+
+	argv[n_cmd] = replaced ? NULL : (char *)arg;
+	argv[n_cmd + 1] = NULL;
+}
+
+
+/*
+ *	emit_output
+ *
+ *	Details:
+ *		- writes everything captured in out_fd to stdout and closes it,
+ *		  with sendfile where possible
+ */
+static void emit_output(int out_fd)
+{
+	off_t off = 0, size = lseek(out_fd, 0, SEEK_END);
+	char buf[4096];
+	ssize_t n;
+
+	while(off < size)
+	{
+		n = sendfile(STDOUT_FILENO, out_fd, &off, size - off);
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n <= 0)
+		{
+			break;
+		}
+	}
+
+	/* sendfile refused the target, copy what is left by hand */
+	lseek(out_fd, off, SEEK_SET);
+	while(off < size && (n = read(out_fd, buf, sizeof(buf))) > 0)
+	{
+		if(write(STDOUT_FILENO, buf, n) != n)
+		{
+			break;
+		}
+		off += n;
+	}
+
+	close(out_fd);
+}
+
+
+/*
+ *	parallel_cmd - the "parallel" builtin
+ *
+ *	Details:
+ *		- "parallel [-j N] command [args...] [::: input...]" runs command
+ *		  once per input, with at most N (default: online CPUs) commands
+ *		  running at the same time
+ *		- inputs come after ":::", or one per line from stdin
+ *		- "{}" in an argument is replaced by the input, without "{}" the
+ *		  input is appended as last argument
+ *		- commands are started by launch_cmd with /dev/null as stdin,
+ *		  their stdout is captured in a memfd and written out in input
+ *		  order as soon as all earlier inputs are done; stderr is not
+ *		  captured
+ *		- inputs that are done but not yet written out keep their memfd
+ *		  open, at most PARALLEL_BACKLOG of them beyond the N slots
+ *		- all commands form one foreground job; one killed by SIGINT
+ *		  stops new launches
+ *		- the total wall time is reported on stderr
+ *
+ *	Return value
+ *		- number of failed commands, at most 101
+ */
+int parallel_cmd(char **parsed_args)
+{
+	long n_slots = sysconf(_SC_NPROCESSORS_ONLN);
+	struct par_item *items = NULL;
+	int n_items = 0, n_cmd = 0, next = 0, emitted = 0, running = 0;
+	int failed = 0, aborted = 0, devnull;
+	char **cmd = parsed_args + 1;
+	struct timespec start, end;
+	struct job *job;
+	sigset_t old;
+
+	if(*cmd && strcmp(*cmd, "-j") == 0 && cmd[1])
+	{
+		n_slots = strtol(cmd[1], NULL, 10);
+		cmd += 2;
+	}
+	if(n_slots < 1)
+	{
+		n_slots = 1;
+	}
+
+	while(cmd[n_cmd] && strcmp(cmd[n_cmd], ":::") != 0)
+	{
+		n_cmd++;
+	}
+	if(n_cmd == 0)
+	{
+		fprintf(stderr, "usage: parallel [-j N] command [args...] "
+				"[::: input...]\n");
+		return 1;
+	}
+
+	if(cmd[n_cmd])
+	{
+		for(char **a = cmd + n_cmd + 1; *a; a++)
+		{
+			n_items++;
+		}
+		items = malloc((n_items + 1) * sizeof(*items));
+		for(int i = 0; items && i < n_items; i++)
+		{
+			items[i].arg = strdup(cmd[n_cmd + 1 + i]);
+		}
+	}
+	else
+	{
+		n_items = read_items(&items);
+	}
+	if(n_items < 0 || (n_items > 0 && !items))
+	{
+		fprintf(stderr, "parallel: out of memory\n");
+		return 1;
+	}
+
+	devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fflush(stdout);
+
+	sigchld_block(&old);
+	job = job_create(&cmd, 1, n_items, 0);
+	if(!job)
+	{
+		sigchld_restore(&old);
+		fprintf(stderr, "parallel: out of memory\n");
+		return 1;
+	}
+
+	while(emitted < n_items)
+	{
+		/* SIGCHLD is blocked, the states cannot change under us; any
+		 * command killed by SIGINT stops new launches, not just the
+		 * head of the queue */
+		running = 0;
+		for(int i = emitted; i < next; i++)
+		{
+			struct process *p = (items[i].proc >= 0)
+					? &job->procs[items[i].proc] : NULL;
+
+			if(p && p->state != PROC_DONE)
+			{
+				running++;
+			}
+			else if(p && WIFSIGNALED(p->status)
+					&& WTERMSIG(p->status) == SIGINT)
+			{
+				aborted = 1;
+			}
+		}
+
+		while(!aborted && next < n_items && running < n_slots
+				&& next - emitted < n_slots + PARALLEL_BACKLOG)
+		{
+			struct par_item *it = &items[next++];
+			char *argv[n_cmd + 2];
+			long long t_launch;
+			pid_t pid;
+
+			it->proc = -1;
+			it->out_fd = memfd_create("parallel", MFD_CLOEXEC);
+			if(it->out_fd < 0)
+			{
+				fprintf(stderr, "parallel: %s\n", strerror(errno));
+				failed++;
+				continue;
+			}
+
+			/* a new process group once every member of the old one
+			 * is gone, setpgid cannot join an empty group */
+			if(running == 0)
+			{
+				job->pgid = 0;
+			}
+
+			build_argv(cmd, n_cmd, it->arg, argv);
+			t_launch = stats_timing ? clock_ns() : 0;
+			pid = launch_cmd(argv, devnull, it->out_fd, NULL,
+					job_launch_pgid(job), 1);
+			if(t_launch)
+			{
+				stats_record(STAT_LAUNCH, clock_ns() - t_launch);
+			}
+			for(int i = 0; i < n_cmd; i++)
+			{
+				if(argv[i] != cmd[i])
+				{
+					free(argv[i]);
+				}
+			}
+
+			if(pid < 0)
+			{
+				failed++;
+				continue;
+			}
+			job_add_process(job, pid);
+			it->proc = job->n_procs - 1;
+			running++;
+		}
+
+		/* write out every finished input at the head, in order */
+		while(emitted < next)
+		{
+			struct par_item *it = &items[emitted];
+			struct process *p = (it->proc >= 0)
+					? &job->procs[it->proc] : NULL;
+
+			if(p && p->state != PROC_DONE)
+			{
+				break;
+			}
+			if(p && p->status != 0)
+			{
+				failed++;
+			}
+			if(it->out_fd >= 0)
+			{
+				emit_output(it->out_fd);
+			}
+			emitted++;
+		}
+
+		if(emitted == n_items || (aborted && emitted == next))
+		{
+			break;
+		}
+
+		/* the head is still running; unless a slot is free, wait for
+		 * SIGCHLD */
+		if(aborted || next == n_items || running == n_slots
+				|| next - emitted >= n_slots + PARALLEL_BACKLOG)
+		{
+			sigsuspend(&old);
+		}
+	}
+
+	job_wait(job, 1, &old);
+	sigchld_restore(&old);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "parallel: %d jobs, %ld slots, %d failed, %.3f s wall\n",
+			emitted, n_slots, failed, (end.tv_sec - start.tv_sec)
+			+ (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	for(int i = 0; i < n_items; i++)
+	{
+		free(items[i].arg);
+	}
+	free(items);
+	close(devnull);
+
+	return (failed > 101) ? 101 : failed;
+}
@@ -0,0 +1,519 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>		/* malloc(), free() */
+#include <ctype.h>		/* isdigit() */
+
+#include "shell.h"
+
+
+/*
+ *	struct arena_block
+ *
+ *	@next	: previously filled block
+ *	@size	: usable bytes in data
+ *	@used	: bytes handed out from data
+ *	@data	: storage
+ */
+struct arena_block
+{
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+
+/*
+ *	arena_alloc
+ *
+ *	Details:
+ *		- hands out n bytes, pointer aligned, from the current block
+ *		- a new block (at least twice the previous one) is chained in
+ *		  when the current block is full, earlier allocations never move
+ *
+ *	Return value
+ *		- pointer to the bytes, or NULL if out of memory
+ */
+void *arena_alloc(struct arena *arena, size_t n)
+{
+	struct arena_block *b = arena->head;
+	size_t align = sizeof(void *);
+
+	n = (n + align - 1) & ~(align - 1);
+
+	if(!b || b->size - b->used < n)
+	{
+		size_t size = b ? 2 * b->size : ARENA_MIN_SIZE;
+
+		while(size < n)
+		{
+			size *= 2;
+		}
+
+		b = malloc(sizeof(*b) + size);
+		if(!b)
+		{
+			return NULL;
+		}
+		b->next = arena->head;
+		b->size = size;
+		b->used = 0;
+		arena->head = b;
+	}
+
+	b->used += n;
+	return b->data + b->used - n;
+}
+
+
+/*
+ *	arena_reset
+ *
+ *	Details:
+ *		- releases everything handed out since the last reset
+ *		- if the last line spilled into several blocks, they are replaced
+ *		  by one block as large as all of them together, so in steady
+ *		  state a line is parsed without touching the heap
+ */
+void arena_reset(struct arena *arena)
+{
+	struct arena_block *b = arena->head;
+	size_t total = 0;
+
+	if(!b)
+	{
+		return;
+	}
+
+	if(b->next)
+	{
+		while(b)
+		{
+			struct arena_block *next = b->next;
+			total += b->size;
+			free(b);
+			b = next;
+		}
+
+		arena->head = NULL;
+		b = malloc(sizeof(*b) + total);
+		if(!b)
+		{
+			return;
+		}
+		b->next = NULL;
+		b->size = total;
+		arena->head = b;
+	}
+
+	b->used = 0;
+}
+
+
+/*
+ *	arena_free
+ *
+ *	Details:
+ *		- returns every block of the arena to the heap
+ */
+void arena_free(struct arena *arena)
+{
+	while(arena->head)
+	{
+		struct arena_block *next = arena->head->next;
+		free(arena->head);
+		arena->head = next;
+	}
+}
+
+
+/*
+ *	is_blank / is_operator - character classes of the tokenizer
+ */
+static int is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int is_operator(char c)
+{
+	return c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+
+/*
+ *	token_name
+ *
+ *	Return value
+ *		- the text of an operator token, for error messages
+ */
+const char *token_name(enum token_type type)
+{
+	switch(type)
+	{
+		case TOK_PIPE:		return "|";
+		case TOK_AMP:		return "&";
+		case TOK_SEMI:		return ";";
+		case TOK_AND_IF:	return "&&";
+		case TOK_OR_IF:		return "||";
+		case TOK_NEWLINE:	return "newline";
+		case TOK_END:		return "end of file";
+		default:		return "redirection";
+	}
+}
+
+
+/*
+ *	operator_token
+ *
+ *	Details:
+ *		- c is the operator character at pos, passed separately since
+ *		  pos may already hold the NUL of the previous word
+ *		- "&&" and "||" are single tokens
+ *		- for a redirection, *redir is set to its type: '<' reads,
+ *		  '>' writes, ">>" appends, "<<<" is a here-string and ">&" or
+ *		  "<&" duplicates a descriptor
+ */
+static enum token_type operator_token(struct lexer *lex, char *pos, char c,
+		enum redir_type *redir)
+{
+	lex->pos = pos + 1;
+	if(c == ';')
+	{
+		return TOK_SEMI;
+	}
+	if(c == '|' || c == '&')
+	{
+		if(pos[1] == c)
+		{
+			lex->pos++;
+			return (c == '|') ? TOK_OR_IF : TOK_AND_IF;
+		}
+		return (c == '|') ? TOK_PIPE : TOK_AMP;
+	}
+
+	*redir = (c == '<') ? REDIR_IN : REDIR_OUT;
+	if(pos[1] == '&')
+	{
+		*redir = REDIR_DUP;
+		lex->pos++;
+	}
+	else if(c == '>' && pos[1] == '>')
+	{
+		*redir = REDIR_APPEND;
+		lex->pos++;
+	}
+	else if(c == '<' && pos[1] == '<' && pos[2] == '<')
+	{
+		*redir = REDIR_STRING;
+		lex->pos += 2;
+	}
+
+	return TOK_REDIR;
+}
+
+
+/*
+ *	next_token
+ *
+ *	Details:
+ *		- returns the next token of the line, words are unquoted in place:
+ *		  the unquoted text is written over the quoted one (it is never
+ *		  longer) and NUL-terminated, *text points into the line
+ *		- '...' is literal, "..." and unquoted text honour '\' escapes
+ *		- an unquoted '#' at the start of a word comments out the rest
+ *		  of the line
+ *		- a single unquoted digit right before '<' or '>' is the
+ *		  descriptor the redirection applies to (TOK_IO_NUMBER)
+ *		- with lex->multiline set (scripts), a newline is a token of
+ *		  its own instead of a blank and lex->line counts them
+ *
+ *	Return value
+ *		- TOK_WORD, TOK_IO_NUMBER, TOK_REDIR (type in *redir), an
+ *		  operator, TOK_END, or TOK_ERROR on an unterminated quote
+ */
+enum token_type next_token(struct lexer *lex, char **text,
+		enum redir_type *redir)
+{
+	char *rd = lex->pos;
+	char *wr;
+	char c;
+
+	/* the character under the NUL is a blank or an operator */
+	if(lex->saved)
+	{
+		c = lex->saved;
+		lex->saved = 0;
+		if(is_operator(c))
+		{
+			return operator_token(lex, rd, c, redir);
+		}
+		if(c == '\n' && lex->multiline)
+		{
+			lex->pos = rd + 1;
+			lex->line++;
+			return TOK_NEWLINE;
+		}
+		rd++;
+	}
+
+	while(is_blank(*rd) && !(*rd == '\n' && lex->multiline))
+	{
+		rd++;
+	}
+
+	if(*rd == '#' && lex->multiline)
+	{
+		rd += strcspn(rd, "\n");
+	}
+
+	if(*rd == '\n')
+	{
+		lex->pos = rd + 1;
+		lex->line++;
+		return TOK_NEWLINE;
+	}
+
+	if(*rd == '\0' || *rd == '#')
+	{
+		lex->pos = rd;
+		*rd = '\0';
+		return TOK_END;
+	}
+
+	if(is_operator(*rd))
+	{
+		return operator_token(lex, rd, *rd, redir);
+	}
+
+	*text = wr = rd;
+	while((c = *rd) != '\0' && !is_blank(c) && !is_operator(c))
+	{
+		if(c == '\'')
+		{
+			char *end = strchr(rd + 1, '\'');
+			if(!end)
+			{
+				fprintf(stderr, "syntax error: unterminated '\n");
+				return TOK_ERROR;
+			}
+			memmove(wr, rd + 1, end - rd - 1);
+			wr += end - rd - 1;
+			rd = end + 1;
+		}
+		else if(c == '"')
+		{
+			rd++;
+			while(*rd != '"')
+			{
+				if(*rd == '\0')
+				{
+					fprintf(stderr, "syntax error: unterminated \"\n");
+					return TOK_ERROR;
+				}
+				if(*rd == '\\' && (rd[1] == '"' || rd[1] == '\\'
+						|| rd[1] == '$'))
+				{
+					rd++;
+				}
+				*wr++ = *rd++;
+			}
+			rd++;
+		}
+		else if(c == '\\' && rd[1] != '\0')
+		{
+			*wr++ = rd[1];
+			rd += 2;
+		}
+		else
+		{
+			*wr++ = *rd++;
+		}
+	}
+
+	/* the NUL may land on the delimiter (wr == rd), keep it for later */
+	lex->saved = (wr == rd) ? c : 0;
+	lex->pos = rd;
+	*wr = '\0';
+
+	if((c == '<' || c == '>') && rd == *text + 1 && isdigit(**text))
+	{
+		return TOK_IO_NUMBER;
+	}
+
+	return TOK_WORD;
+}
+
+
+/*
+ *	parse_redir
+ *
+ *	Details:
+ *		- reads the target word of a redirection and adds the
+ *		  redirection to the end of *list, taken from the arena
+ *		- fd is the descriptor written before the operator, -1 if none
+ *
+ *	Return value
+ *		- 0 on success, -1 on a syntax error or if out of memory
+ */
+static int parse_redir(struct lexer *lex, struct arena *arena,
+		struct redir **list, enum redir_type type, int fd)
+{
+	enum redir_type unused;
+	struct redir *r;
+	char *text;
+
+	if(next_token(lex, &text, &unused) != TOK_WORD)
+	{
+		fprintf(stderr, "syntax error: redirection without a target\n");
+		return -1;
+	}
+
+	r = arena_alloc(arena, sizeof(*r));
+	if(!r)
+	{
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	if(fd < 0)
+	{
+		fd = (type == REDIR_IN || type == REDIR_STRING) ? 0 : 1;
+	}
+	r->fd = fd;
+	r->type = type;
+	r->target = text;
+	r->src = -1;
+	r->next = NULL;
+
+	while(*list)
+	{
+		list = &(*list)->next;
+	}
+	*list = r;
+
+	return 0;
+}
+
+
+/*
+ *	parse_cmd
+ *
+ *	Details:
+ *		- tokenizes the line in place, no token is copied
+ *		- the argv arrays of all stages share one pointer array taken
+ *		  from the arena, a '|' ends the argv of a stage with NULL
+ *		- stage i of the pipeline is cmd->stages[i], its redirections
+ *		  (in the order written) are the list cmd->redirs[i]
+ *		- a trailing '&' sets cmd->background
+ *
+ * 	Return Value:
+ *		- number of pipeline stages (0 for an empty line)
+ *		- -1, on a syntax error or if the arena is out of memory
+ */
+int parse_cmd(char *line, struct arena *arena, struct cmd_line *cmd)
+{
+	struct lexer lex = { line, 0, 0, 0 };
+	size_t max_args = 2, max_stages = 2;
+	char **argv, *text = NULL;
+	int n_args = 0, n_words = 0, io_number = -1;
+	enum token_type type;
+	enum redir_type redir;
+
+	/* every token takes at least one byte of the line and every stage
+	 * but the first starts after a '|' */
+	for(char *p = line; *p; p++)
+	{
+		max_args++;
+		max_stages += (*p == '|');
+	}
+
+	cmd->n_stages = 0;
+	cmd->background = 0;
+	argv = arena_alloc(arena, max_args * sizeof(char *));
+	cmd->stages = arena_alloc(arena, max_stages * sizeof(char **));
+	cmd->redirs = arena_alloc(arena, max_stages * sizeof(struct redir *));
+	if(!argv || !cmd->stages || !cmd->redirs)
+	{
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	cmd->stages[0] = argv;
+	cmd->redirs[0] = NULL;
+	while((type = next_token(&lex, &text, &redir)) != TOK_END
+			&& type != TOK_ERROR)
+	{
+		if(cmd->background)
+		{
+			fprintf(stderr, "syntax error near '&'\n");
+			return -1;
+		}
+
+		if(type == TOK_WORD)
+		{
+			argv[n_args++] = text;
+			n_words++;
+			continue;
+		}
+
+		if(type == TOK_IO_NUMBER)
+		{
+			io_number = *text - '0';
+			continue;
+		}
+
+		if(type == TOK_REDIR)
+		{
+			if(parse_redir(&lex, arena, &cmd->redirs[cmd->n_stages],
+					redir, io_number) < 0)
+			{
+				return -1;
+			}
+			io_number = -1;
+			continue;
+		}
+
+		/* lists of commands are only understood by scripts */
+		if(n_words == 0 || (type != TOK_PIPE && type != TOK_AMP))
+		{
+			fprintf(stderr, "syntax error near '%s'\n",
+					token_name(type));
+			return -1;
+		}
+
+		if(type == TOK_AMP)
+		{
+			cmd->background = 1;
+			continue;
+		}
+
+		argv[n_args++] = NULL;
+		cmd->stages[++cmd->n_stages] = argv + n_args;
+		cmd->redirs[cmd->n_stages] = NULL;
+		n_words = 0;
+	}
+
+	if(type == TOK_ERROR)
+	{
+		return -1;
+	}
+
+	if(n_words == 0)
+	{
+		if(cmd->n_stages > 0)
+		{
+			fprintf(stderr, "syntax error near '|'\n");
+			return -1;
+		}
+		if(cmd->redirs[0])
+		{
+			fprintf(stderr, "syntax error: missing command\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	argv[n_args] = NULL;
+	return ++cmd->n_stages;
+}
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>		/* getenv() */
+#include <unistd.h>		/* access() */
+#include <sys/stat.h>		/* stat() */
+
+#include "shell.h"
+
+
+/*
+ *	struct path_entry
+ *
+ *	@name	: command name as typed by the user
+ *	@path	: absolute path the name resolved to
+ *	@hits	: number of launches served from this entry
+ *	@next	: next entry in the same bucket
+ */
+struct path_entry
+{
+	char *name;
+	char *path;
+	unsigned int hits;
+	struct path_entry *next;
+};
+
+static struct path_entry *path_table[PATH_HASH_SIZE];
+
+/* value of $PATH the cached entries were resolved against */
+static char *hashed_path_env;
+
+
+/*
+ *	hash_name - FNV-1a hash of a command name
+ */
+static unsigned int hash_name(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while(*name)
+	{
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+
+	return h % PATH_HASH_SIZE;
+}
+
+
+/*
+ *	path_hash_clear
+ *
+ *	Details:
+ *		- drops every cached entry
+ */
+void path_hash_clear(void)
+{
+	for(int i = 0; i < PATH_HASH_SIZE; i++)
+	{
+		struct path_entry *e = path_table[i];
+
+		while(e)
+		{
+			struct path_entry *next = e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+			e = next;
+		}
+		path_table[i] = NULL;
+	}
+}
+
+
+/*
+ *	path_hash_check_env
+ *
+ *	Details:
+ *		- invalidates the whole table when $PATH differs from the value
+ *		  the entries were resolved against
+ *
+ *	Return value
+ *		- $PATH, or NULL if out of memory (the table is left empty)
+ */
+static const char *path_hash_check_env(void)
+{
+	const char *path_env = getenv("PATH");
+
+	if(!path_env)
+	{
+		path_env = DEFAULT_PATH;
+	}
+
+	if(!hashed_path_env || strcmp(hashed_path_env, path_env) != 0)
+	{
+		path_hash_clear();
+		free(hashed_path_env);
+		hashed_path_env = strdup(path_env);
+		if(!hashed_path_env)
+		{
+			return NULL;
+		}
+	}
+
+	return path_env;
+}
+
+
+/*
+ *	resolve_path
+ *
+ *	Details:
+ *		- walks every directory of path_env looking for an executable
+ *		  regular file called name
+ *		- an empty component stands for the current directory
+ *
+ *	Return value
+ *		- malloc'ed absolute path, or NULL if not found
+ */
+static char *resolve_path(const char *name, const char *path_env)
+{
+	size_t name_len = strlen(name);
+	const char *dir = path_env;
+
+	while(1)
+	{
+		const char *end = strchrnul(dir, ':');
+		size_t dir_len = end - dir;
+		char *candidate = malloc(dir_len + name_len + 3);
+		struct stat st;
+
+		if(!candidate)
+		{
+			return NULL;
+		}
+
+		if(dir_len == 0)
+		{
+			candidate[0] = '.';
+			dir_len = 1;
+		}
+		else
+		{
+			memcpy(candidate, dir, dir_len);
+		}
+		candidate[dir_len] = '/';
+		memcpy(candidate + dir_len + 1, name, name_len + 1);
+
+		if(stat(candidate, &st) == 0 && S_ISREG(st.st_mode)
+				&& access(candidate, X_OK) == 0)
+		{
+			return candidate;
+		}
+		free(candidate);
+
+		if(*end == '\0')
+		{
+			return NULL;
+		}
+		dir = end + 1;
+	}
+}
+
+
+/*
+ *	path_lookup
+ *
+ *	Details:
+ *		- names containing a '/' are returned unchanged
+ *		- otherwise returns the cached absolute path of name, resolving
+ *		  and caching it on a miss
+ *
+ *	Return value
+ *		- path to exec, or NULL if name is not found in $PATH or out
+ *		  of memory
+ */
+const char *path_lookup(const char *name)
+{
+	const char *path_env;
+	struct path_entry *e;
+	unsigned int h;
+	char *path;
+
+	if(strchr(name, '/'))
+	{
+		return name;
+	}
+
+	path_env = path_hash_check_env();
+	if(!path_env)
+	{
+		return NULL;
+	}
+	h = hash_name(name);
+
+	for(e = path_table[h]; e; e = e->next)
+	{
+		if(strcmp(e->name, name) == 0)
+		{
+			e->hits++;
+			return e->path;
+		}
+	}
+
+	path = resolve_path(name, path_env);
+	if(!path)
+	{
+		return NULL;
+	}
+
+	e = malloc(sizeof(*e));
+	if(!e)
+	{
+		free(path);
+		return NULL;
+	}
+	e->name = strdup(name);
+	if(!e->name)
+	{
+		free(e);
+		free(path);
+		return NULL;
+	}
+	e->path = path;
+	e->hits = 1;
+	e->next = path_table[h];
+	path_table[h] = e;
+
+	return e->path;
+}
+
+
+/*
+ *	path_forget
+ *
+ *	Details:
+ *		- drops the cached entry of name, called when exec of the cached
+ *		  path fails with ENOENT
+ *
+ *	Return value
+ *		- 1, if an entry was dropped
+ *		- 0, if name was not cached
+ */
+int path_forget(const char *name)
+{
+	struct path_entry **pe = &path_table[hash_name(name)];
+
+	for(; *pe; pe = &(*pe)->next)
+	{
+		struct path_entry *e = *pe;
+
+		if(strcmp(e->name, name) == 0)
+		{
+			*pe = e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ *	hash_cmd - the "hash" builtin
+ *
+ *	Details:
+ *		- "hash" lists the cached commands with their hit counts
+ *		- "hash -r" forgets every cached command
+ *		- "hash name..." resolves and caches each name
+ *
+ *	Return value
+ *		- 0 on success, 1 if a name could not be found
+ */
+int hash_cmd(char **parsed_args)
+{
+	int ret = 0;
+
+	if(!parsed_args[1])
+	{
+		path_hash_check_env();
+		printf("hits\tcommand\n");
+		for(int i = 0; i < PATH_HASH_SIZE; i++)
+		{
+			for(struct path_entry *e = path_table[i]; e; e = e->next)
+			{
+				printf("%4u\t%s\n", e->hits, e->path);
+			}
+		}
+		return 0;
+	}
+
+	if(strcmp(parsed_args[1], "-r") == 0)
+	{
+		path_hash_clear();
+		return 0;
+	}
+
+	for(int i = 1; parsed_args[i]; i++)
+	{
+		path_forget(parsed_args[i]);
+		if(!path_lookup(parsed_args[i]))
+		{
+			fprintf(stderr, "hash: %s: not found\n", parsed_args[i]);
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>		/* strtoll() */
+#include <unistd.h>		/* dup2(), write() */
+#include <fcntl.h>		/* open(), fallocate() */
+#include <sys/mman.h>		/* memfd_create() */
+#include <sys/stat.h>		/* fstat() */
+
+#include "shell.h"
+
+/* bytes preallocated past the end of output targets, 0 is off */
+static long long prealloc_size;
+
+
+/*
+ *	preallocate
+ *
+ *	Details:
+ *		- reserves prealloc_size bytes past the end of the regular file
+ *		  behind fd with fallocate, without changing its size, so a
+ *		  large output lands in few extents
+ *		- reserved blocks the command does not fill stay allocated
+ *		  past the end of the file until it is truncated
+ *		- a file system without fallocate is reported once and then
+ *		  ignored
+ */
+static void preallocate(int fd)
+{
+	static int warned;
+	struct stat st;
+
+	if(prealloc_size == 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+	{
+		return;
+	}
+
+	if(fallocate(fd, FALLOC_FL_KEEP_SIZE, st.st_size, prealloc_size) < 0
+			&& !warned)
+	{
+		fprintf(stderr, "prealloc: %s\n", strerror(errno));
+		warned = 1;
+	}
+}
+
+
+/*
+ *	open_here_string
+ *
+ *	Return value
+ *		- a memfd holding text and a newline, positioned at its start,
+ *		  or -1 on error
+ */
+static int open_here_string(const char *text)
+{
+	size_t len = strlen(text);
+	int fd = memfd_create("here-string", MFD_CLOEXEC);
+
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	if(write(fd, text, len) != (ssize_t)len || write(fd, "\n", 1) != 1
+			|| lseek(fd, 0, SEEK_SET) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*
+ *	dup_source
+ *
+ *	Details:
+ *		- parses the target of ">&"/"<&", a single digit, and checks
+ *		  that the descriptor is open or redirected earlier in list
+ *
+ *	Return value
+ *		- the descriptor, or -1 with errno set
+ */
+static int dup_source(struct redir *list, struct redir *r)
+{
+	int fd;
+
+	if(!(r->target[0] >= '0' && r->target[0] <= '9') || r->target[1])
+	{
+		errno = EBADF;
+		return -1;
+	}
+	fd = r->target[0] - '0';
+
+	for(; list != r; list = list->next)
+	{
+		if(list->fd == fd)
+		{
+			return fd;
+		}
+	}
+
+	return (fcntl(fd, F_GETFD) < 0) ? -1 : fd;
+}
+
+
+/*
+ *	redir_open
+ *
+ *	Details:
+ *		- opens the file or here-string behind every redirection of
+ *		  list into r->src, with O_CLOEXEC and at or above REDIR_FD_MIN
+ *		  so that installing one redirection never clobbers the source
+ *		  of a later one
+ *		- '>' truncates, ">>" appends, both create the file; output
+ *		  files get preallocate'd
+ *		- a here-string is copied into a memfd
+ *		- files are opened by the shell, so a missing or unwritable
+ *		  file is reported before anything is started
+ *
+ *	Return value
+ *		- 0 on success, -1 on error (nothing is left open)
+ */
+int redir_open(struct redir *list)
+{
+	for(struct redir *r = list; r; r = r->next)
+	{
+		int fd = -1;
+
+		switch(r->type)
+		{
+			case REDIR_IN:
+				fd = open(r->target, O_RDONLY | O_CLOEXEC);
+				break;
+
+			case REDIR_OUT:
+			case REDIR_APPEND:
+				fd = open(r->target, O_WRONLY | O_CREAT | O_CLOEXEC
+						| (r->type == REDIR_APPEND ? O_APPEND : O_TRUNC),
+						0666);
+				if(fd >= 0)
+				{
+					preallocate(fd);
+				}
+				break;
+
+			case REDIR_STRING:
+				fd = open_here_string(r->target);
+				break;
+
+			case REDIR_DUP:
+				r->src = dup_source(list, r);
+				if(r->src < 0)
+				{
+					fprintf(stderr, "%s: bad file descriptor\n",
+							r->target);
+					redir_close(list);
+					return -1;
+				}
+				continue;
+		}
+
+		if(fd >= 0 && fd < REDIR_FD_MIN)
+		{
+			int high = fcntl(fd, F_DUPFD_CLOEXEC, REDIR_FD_MIN);
+
+			close(fd);
+			fd = high;
+		}
+		if(fd < 0)
+		{
+			fprintf(stderr, "%s: %s\n", (r->type == REDIR_STRING)
+					? "<<<" : r->target, strerror(errno));
+			redir_close(list);
+			return -1;
+		}
+		r->src = fd;
+	}
+
+	return 0;
+}
+
+
+/*
+ *	redir_close
+ *
+ *	Details:
+ *		- closes what redir_open opened, once the command is started
+ */
+void redir_close(struct redir *list)
+{
+	for(struct redir *r = list; r; r = r->next)
+	{
+		if(r->type != REDIR_DUP && r->src >= 0)
+		{
+			close(r->src);
+		}
+		r->src = -1;
+	}
+}
+
+
+/*
+ *	redir_apply
+ *
+ *	Details:
+ *		- dup2's every r->src onto r->fd, in the order written, so
+ *		  "> file 2>&1" sends both stdout and stderr to file
+ *		- runs in the child between fork and exec, or in the shell
+ *		  itself around a builtin (see redir_save)
+ *
+ *	Return value
+ *		- 0 on success, -1 on error
+ */
+int redir_apply(struct redir *list)
+{
+	for(struct redir *r = list; r; r = r->next)
+	{
+		if(dup2(r->src, r->fd) < 0)
+		{
+			fprintf(stderr, "%d: %s\n", r->fd, strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ *	redir_save / redir_restore - redirections of builtins
+ *
+ *	Details:
+ *		- redir_save keeps an O_CLOEXEC copy of every descriptor list
+ *		  redirects in saved[] (-1 if it was closed), redir_restore puts
+ *		  them back
+ *		- stdout is flushed on both sides, so buffered output of the
+ *		  shell goes where it was written
+ */
+void redir_save(struct redir *list, int saved[REDIR_FD_MIN])
+{
+	fflush(stdout);
+	for(int fd = 0; fd < REDIR_FD_MIN; fd++)
+	{
+		saved[fd] = -2;
+	}
+
+	for(struct redir *r = list; r; r = r->next)
+	{
+		if(saved[r->fd] == -2)
+		{
+			saved[r->fd] = fcntl(r->fd, F_DUPFD_CLOEXEC, REDIR_FD_MIN);
+		}
+	}
+}
+
+void redir_restore(int saved[REDIR_FD_MIN])
+{
+	fflush(stdout);
+	for(int fd = 0; fd < REDIR_FD_MIN; fd++)
+	{
+		if(saved[fd] >= 0)
+		{
+			dup2(saved[fd], fd);
+			close(saved[fd]);
+		}
+		else if(saved[fd] == -1)
+		{
+			close(fd);
+		}
+	}
+}
+
+
+/*
+ *	prealloc_cmd - the "prealloc" builtin
+ *
+ *	Details:
+ *		- "prealloc" prints the bytes preallocated for output
+ *		  redirections
+ *		- "prealloc size[K|M|G]" sets them, 0 turns preallocation off
+ *
+ *	Return value
+ *		- 0 on success, 1 on an invalid size
+ */
+int prealloc_cmd(char **parsed_args)
+{
+	long long size;
+	char *end;
+
+	if(!parsed_args[1])
+	{
+		printf("%lld\n", prealloc_size);
+		return 0;
+	}
+
+	size = strtoll(parsed_args[1], &end, 0);
+	switch(*end)
+	{
+		case 'G':
+			size <<= 10;
+			/* fall through */
+		case 'M':
+			size <<= 10;
+			/* fall through */
+		case 'K':
+			size <<= 10;
+			end++;
+			break;
+	}
+
+	if(*end != '\0' || size < 0)
+	{
+		fprintf(stderr, "prealloc: invalid size %s\n", parsed_args[1]);
+		return 1;
+	}
+
+	prealloc_size = size;
+	return 0;
+}
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>		/* strtol() */
+#include <unistd.h>		/* read(), write() */
+#include <fcntl.h>		/* splice(), tee(), F_SETPIPE_SZ */
+#include <sys/stat.h>		/* fstat() */
+
+#include "shell.h"
+
+/* capacity requested for every pipeline pipe, 0 keeps the kernel default */
+static int pipe_size;
+
+
+/*
+ *	set_pipe_size
+ *
+ *	Details:
+ *		- grows the pipe behind fd to the capacity set with "pipesz"
+ *		- a capacity the kernel refuses (above /proc/sys/fs/pipe-max-size
+ *		  for unprivileged users) is reported once and then ignored
+ */
+void set_pipe_size(int fd)
+{
+	static int warned;
+
+	if(pipe_size == 0)
+	{
+		return;
+	}
+
+	if(fcntl(fd, F_SETPIPE_SZ, pipe_size) < 0 && !warned)
+	{
+		fprintf(stderr, "pipesz: cannot set pipe size to %d: %s\n",
+				pipe_size, strerror(errno));
+		warned = 1;
+	}
+}
+
+
+/*
+ *	pipesz_cmd - the "pipesz" builtin
+ *
+ *	Details:
+ *		- "pipesz" prints the capacity used for pipeline pipes
+ *		- "pipesz bytes" sets it, 0 restores the kernel default
+ *
+ *	Return value
+ *		- 0 on success, 1 on an invalid size
+ */
+int pipesz_cmd(char **parsed_args)
+{
+	char *end;
+	long size;
+
+	if(!parsed_args[1])
+	{
+		printf("%d\n", pipe_size);
+		return 0;
+	}
+
+	size = strtol(parsed_args[1], &end, 0);
+	if(*end != '\0' || size < 0 || size > (1L << 30))
+	{
+		fprintf(stderr, "pipesz: invalid size %s\n", parsed_args[1]);
+		return 1;
+	}
+
+	pipe_size = size;
+	return 0;
+}
+
+
+/*
+ *	copy_all - moves len bytes from in to out with read/write
+ *
+ *	Details:
+ *		- fallback for targets splice cannot write to (e.g. terminals)
+ *		- len < 0 copies until end of input
+ *
+ *	Return value
+ *		- 0 on success (or early end of input), -1 on error
+ */
+static int copy_all(int in, int out, ssize_t len)
+{
+	static char buf[RELAY_CHUNK];
+
+	while(len != 0)
+	{
+		size_t want = (len < 0 || len > RELAY_CHUNK) ? RELAY_CHUNK : len;
+		ssize_t n = read(in, buf, want), done = 0;
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n <= 0)
+		{
+			return n;
+		}
+
+		while(done < n)
+		{
+			ssize_t w = write(out, buf + done, n - done);
+			if(w < 0)
+			{
+				return -1;
+			}
+			done += w;
+		}
+
+		if(len > 0)
+		{
+			len -= n;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ *	splice_all - moves exactly len bytes from pipe in to out
+ *
+ *	Details:
+ *		- uses splice, falls back to copy_all when out does not support it
+ *
+ *	Return value
+ *		- 0 on success, -1 on error
+ */
+static int splice_all(int in, int out, size_t len)
+{
+	while(len > 0)
+	{
+		ssize_t n = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n < 0 && errno == EINVAL)
+		{
+			return copy_all(in, out, len);
+		}
+		if(n <= 0)
+		{
+			return -1;
+		}
+		len -= n;
+	}
+
+	return 0;
+}
+
+
+/*
+ *	relay - fans stdin out to every fd of out[]
+ *
+ *	Details:
+ *		- per chunk, tee duplicates the data at the head of the stdin
+ *		  pipe into an empty scratch pipe once for every target but the
+ *		  last, and splice drains the scratch pipe into that target;
+ *		  the last target gets the chunk spliced straight out of stdin
+ *		- the scratch pipe is always empty and at least RELAY_CHUNK big
+ *		  when tee runs, so every tee of a chunk duplicates the same
+ *		  bytes and no target gets more or less than the others
+ *		- data never passes through a user-space buffer
+ *
+ *	Return value
+ *		- 0 on success, -1 on error
+ */
+static int relay(int *out, int n_out)
+{
+	int scratch[2] = { -1, -1 };
+	int ret = 0;
+
+	if(n_out > 1)
+	{
+		if(pipe2(scratch, O_CLOEXEC) < 0)
+		{
+			return -1;
+		}
+		fcntl(scratch[1], F_SETPIPE_SZ, 4 * RELAY_CHUNK);
+	}
+
+	while(1)
+	{
+		ssize_t n = RELAY_CHUNK;
+
+		for(int i = 0; i < n_out - 1; i++)
+		{
+			ssize_t m = tee(STDIN_FILENO, scratch[1], n, 0);
+
+			if(m < 0 && errno == EINTR)
+			{
+				i--;
+				continue;
+			}
+			if(m <= 0)
+			{
+				ret = m;
+				goto out;
+			}
+			n = m;
+
+			if(splice_all(scratch[0], out[i], n) < 0)
+			{
+				ret = -1;
+				goto out;
+			}
+		}
+
+		if(n_out == 1)
+		{
+			n = splice(STDIN_FILENO, NULL, out[0], NULL, n, SPLICE_F_MOVE);
+			if(n < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if(n < 0 && errno == EINVAL)
+			{
+				ret = copy_all(STDIN_FILENO, out[0], -1);
+				goto out;
+			}
+			if(n <= 0)
+			{
+				ret = n;
+				goto out;
+			}
+		}
+		else if(splice_all(STDIN_FILENO, out[n_out - 1], n) < 0)
+		{
+			ret = -1;
+			goto out;
+		}
+	}
+
+out:
+	if(n_out > 1)
+	{
+		close(scratch[0]);
+		close(scratch[1]);
+	}
+	return ret;
+}
+
+
+/*
+ *	tee_cmd - the "tee" builtin, runs as a forked pipeline stage
+ *
+ *	Details:
+ *		- "tee [-a] file..." copies stdin to stdout and to every file
+ *		- with a pipe on stdin the copy is done with tee/splice (see
+ *		  relay), otherwise with plain read/write
+ *		- -a appends by seeking to the end of the file instead of
+ *		  O_APPEND, which splice refuses to write to
+ *
+ *	Return value
+ *		- 0 on success, 1 on error
+ */
+int tee_cmd(char **parsed_args)
+{
+	int append = 0, n_out = 0, ret = 0;
+	int *out;
+	struct stat st;
+
+	parsed_args++;
+	if(*parsed_args && strcmp(*parsed_args, "-a") == 0)
+	{
+		append = 1;
+		parsed_args++;
+	}
+
+	for(n_out = 0; parsed_args[n_out]; n_out++)
+	{
+	}
+
+	out = malloc((n_out + 1) * sizeof(int));
+	if(!out)
+	{
+		return 1;
+	}
+
+	out[0] = STDOUT_FILENO;
+	n_out = 1;
+	for(; *parsed_args; parsed_args++)
+	{
+		int fd = open(*parsed_args, O_WRONLY | O_CREAT | O_CLOEXEC
+				| (append ? 0 : O_TRUNC), 0666);
+		if(fd < 0)
+		{
+			fprintf(stderr, "tee: %s: %s\n", *parsed_args, strerror(errno));
+			ret = 1;
+			continue;
+		}
+		if(append)
+		{
+			lseek(fd, 0, SEEK_END);
+		}
+		out[n_out++] = fd;
+	}
+
+	if(fstat(STDIN_FILENO, &st) == 0 && S_ISFIFO(st.st_mode))
+	{
+		if(relay(out, n_out) < 0)
+		{
+			fprintf(stderr, "tee: %s\n", strerror(errno));
+			ret = 1;
+		}
+	}
+	else
+	{
+		/* no pipe to tee from, fall back to read/write */
+		static char buf[RELAY_CHUNK];
+		ssize_t n;
+
+		while((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+		{
+			for(int i = 0; i < n_out; i++)
+			{
+				if(write(out[i], buf, n) != n)
+				{
+					ret = 1;
+				}
+			}
+		}
+	}
+
+	for(int i = 1; i < n_out; i++)
+	{
+		close(out[i]);
+	}
+	free(out);
+
+	return ret;
+}
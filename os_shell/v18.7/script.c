@@ -0,0 +1,1222 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>		/* malloc(), realloc(), getenv() */
+#include <stdint.h>		/* uint32_t */
+#include <limits.h>		/* PATH_MAX */
+#include <unistd.h>		/* read(), write(), getpid() */
+#include <fcntl.h>		/* open() */
+#include <signal.h>		/* SIGINT */
+#include <sys/mman.h>		/* mmap() */
+#include <sys/stat.h>		/* fstat(), mkdir() */
+
+#include "shell.h"
+
+/* no node: end of a list, or a missing else */
+#define AST_NONE UINT32_MAX
+
+/* flags of a node */
+#define AST_NEGATE	1
+#define AST_BACKGROUND	2
+
+enum ast_type
+{
+	AST_CMD,
+	AST_AND,
+	AST_OR,
+	AST_IF,
+	AST_WHILE,
+	AST_UNTIL,
+	AST_TYPES,
+};
+
+/*
+ *	struct ast_node - one node of a parsed script
+ *
+ *	@type		: enum ast_type
+ *	@flags		: AST_NEGATE ('!'), AST_BACKGROUND ('&', AST_CMD only)
+ *	@n_stages	: pipeline stages of an AST_CMD
+ *	@next		: next node of the list this node is in
+ *	@a, @b, @c	: AST_CMD: first word and number of words
+ *			  AST_AND/AST_OR: left and right node
+ *			  AST_IF: condition, then and else lists
+ *			  AST_WHILE/AST_UNTIL: condition and body lists
+ *
+ *	Nodes refer to each other by index, so a parsed script can be
+ *	written to the cache and mapped back anywhere. Children always come
+ *	before their parent and a next node after it.
+ */
+struct ast_node
+{
+	uint8_t type;
+	uint8_t flags;
+	uint16_t n_stages;
+	uint32_t next;
+	uint32_t a, b, c;
+};
+
+enum word_kind
+{
+	W_ARG,
+	W_PIPE,
+	W_REDIR,	/* + enum redir_type */
+};
+
+/*
+ *	struct ast_word - an argument, stage separator or redirection of
+ *	an AST_CMD
+ *
+ *	@str	: offset of the text (argument or target) in the string pool
+ *	@kind	: enum word_kind
+ *	@fd	: descriptor a redirection applies to
+ */
+struct ast_word
+{
+	uint32_t str;
+	uint8_t kind;
+	int8_t fd;
+	uint16_t pad;
+};
+
+/*
+ *	struct script_header - start of a parsed script, in memory and in
+ *	the cache file; nodes, words and string pool follow it
+ *
+ *	@dev, @ino, @mtime_*, @size	: the script file the cache entry
+ *					  was parsed from
+ */
+struct script_header
+{
+	char magic[8];
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t size;
+	uint32_t n_nodes;
+	uint32_t n_words;
+	uint32_t pool_size;
+	uint32_t root;
+};
+
+static const char script_magic[8] = "MSHAST01";
+
+/*
+ *	struct ast_builder - growing arrays a script is parsed into
+ */
+struct ast_builder
+{
+	struct ast_node *nodes;
+	struct ast_word *words;
+	char *pool;
+	uint32_t n_nodes, max_nodes;
+	uint32_t n_words, max_words;
+	uint32_t pool_size, max_pool;
+};
+
+struct parser
+{
+	struct lexer lex;
+	enum token_type tok;
+	char *text;
+	enum redir_type redir;
+	const char *name;
+	struct ast_builder *b;
+};
+
+/* argv arrays of the command being run, reset for every command */
+static struct arena arena;
+
+/* set when a command is killed by SIGINT, ends the script */
+static int interrupted;
+
+
+/*
+ *	grow
+ *
+ *	Details:
+ *		- makes room for one more element of size elem in *array,
+ *		  which holds n of at most *max
+ *
+ *	Return value
+ *		- 0 on success, -1 if out of memory
+ */
+static int grow(void **array, uint32_t *max, uint32_t n, size_t elem)
+{
+	void *p;
+	uint32_t size;
+
+	if(n < *max)
+	{
+		return 0;
+	}
+	if(*max >= AST_NONE / 2)
+	{
+		return -1;
+	}
+
+	size = *max ? 2 * *max : 64;
+	p = realloc(*array, (size_t)size * elem);
+	if(!p)
+	{
+		return -1;
+	}
+	*array = p;
+	*max = size;
+	return 0;
+}
+
+
+static uint32_t new_node(struct ast_builder *b, enum ast_type type,
+		uint32_t x, uint32_t y, uint32_t z)
+{
+	struct ast_node *n;
+
+	if(grow((void **)&b->nodes, &b->max_nodes, b->n_nodes, sizeof(*n)) < 0)
+	{
+		return AST_NONE;
+	}
+
+	n = &b->nodes[b->n_nodes];
+	n->type = type;
+	n->flags = 0;
+	n->n_stages = 0;
+	n->next = AST_NONE;
+	n->a = x;
+	n->b = y;
+	n->c = z;
+	return b->n_nodes++;
+}
+
+
+static int new_word(struct ast_builder *b, enum word_kind kind, int fd,
+		const char *text)
+{
+	size_t len = strlen(text) + 1;
+	struct ast_word *w;
+
+	if(grow((void **)&b->words, &b->max_words, b->n_words, sizeof(*w)) < 0)
+	{
+		return -1;
+	}
+	while(b->pool_size + len > b->max_pool)
+	{
+		if(grow((void **)&b->pool, &b->max_pool, b->max_pool, 1) < 0)
+		{
+			return -1;
+		}
+	}
+
+	w = &b->words[b->n_words++];
+	w->str = b->pool_size;
+	w->kind = kind;
+	w->fd = fd;
+	w->pad = 0;
+	memcpy(b->pool + b->pool_size, text, len);
+	b->pool_size += len;
+	return 0;
+}
+
+
+/*
+ *	parser helpers
+ *
+ *	Details:
+ *		- advance reads the next token
+ *		- reserved words ("if", "then", ...) are plain words, they are
+ *		  only special where a command starts
+ *		- syntax_error reports the current token, an unterminated
+ *		  quote was already reported by the lexer
+ */
+static void advance(struct parser *p)
+{
+	p->tok = next_token(&p->lex, &p->text, &p->redir);
+}
+
+static int is_keyword(struct parser *p, const char *word)
+{
+	return p->tok == TOK_WORD && strcmp(p->text, word) == 0;
+}
+
+static int at_list_end(struct parser *p)
+{
+	static const char *const ends[] =
+		{ "then", "elif", "else", "fi", "do", "done" };
+
+	if(p->tok == TOK_END)
+	{
+		return 1;
+	}
+	for(int i = 0; i < 6; i++)
+	{
+		if(is_keyword(p, ends[i]))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void skip_newlines(struct parser *p)
+{
+	while(p->tok == TOK_NEWLINE)
+	{
+		advance(p);
+	}
+}
+
+static int syntax_error(struct parser *p)
+{
+	if(p->tok != TOK_ERROR)
+	{
+		fprintf(stderr, "%s: line %d: syntax error near '%s'\n", p->name,
+				p->lex.line + (p->tok != TOK_NEWLINE),
+				(p->tok == TOK_WORD) ? p->text : token_name(p->tok));
+	}
+	return -1;
+}
+
+static int out_of_memory(void)
+{
+	fprintf(stderr, "out of memory\n");
+	return -1;
+}
+
+static int expect_keyword(struct parser *p, const char *word)
+{
+	if(!is_keyword(p, word))
+	{
+		return syntax_error(p);
+	}
+	advance(p);
+	return 0;
+}
+
+
+static int parse_list(struct parser *p, uint32_t *first);
+
+
+/*
+ *	parse_body
+ *
+ *	Details:
+ *		- parses a list that must not be empty, the condition or body
+ *		  of an if or a loop
+ */
+static int parse_body(struct parser *p, uint32_t *first)
+{
+	if(parse_list(p, first) < 0)
+	{
+		return -1;
+	}
+	return (*first == AST_NONE) ? syntax_error(p) : 0;
+}
+
+
+/*
+ *	parse_if
+ *
+ *	Details:
+ *		- if list then list [elif list then list]... [else list] fi
+ *		- "elif" is an if nested in the else list, it ends at the same
+ *		  "fi"
+ */
+static int parse_if(struct parser *p, uint32_t *out)
+{
+	uint32_t cond, then, other = AST_NONE;
+
+	advance(p);
+	if(parse_body(p, &cond) < 0 || expect_keyword(p, "then") < 0
+			|| parse_body(p, &then) < 0)
+	{
+		return -1;
+	}
+
+	if(is_keyword(p, "elif"))
+	{
+		if(parse_if(p, &other) < 0)
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		if(is_keyword(p, "else"))
+		{
+			advance(p);
+			if(parse_body(p, &other) < 0)
+			{
+				return -1;
+			}
+		}
+		if(expect_keyword(p, "fi") < 0)
+		{
+			return -1;
+		}
+	}
+
+	*out = new_node(p->b, AST_IF, cond, then, other);
+	return (*out == AST_NONE) ? out_of_memory() : 0;
+}
+
+
+/*
+ *	parse_loop
+ *
+ *	Details:
+ *		- while list do list done, or until list do list done
+ */
+static int parse_loop(struct parser *p, uint32_t *out)
+{
+	enum ast_type type = is_keyword(p, "while") ? AST_WHILE : AST_UNTIL;
+	uint32_t cond, body;
+
+	advance(p);
+	if(parse_body(p, &cond) < 0 || expect_keyword(p, "do") < 0
+			|| parse_body(p, &body) < 0 || expect_keyword(p, "done") < 0)
+	{
+		return -1;
+	}
+
+	*out = new_node(p->b, type, cond, body, 0);
+	return (*out == AST_NONE) ? out_of_memory() : 0;
+}
+
+
+/*
+ *	parse_simple
+ *
+ *	Details:
+ *		- a pipeline of simple commands, the same syntax parse_cmd
+ *		  reads from a line: arguments, redirections and '|'
+ *		- every stage becomes its words, a W_PIPE word separates the
+ *		  stages
+ */
+static int parse_simple(struct parser *p, uint32_t *out)
+{
+	struct ast_builder *b = p->b;
+	uint32_t first = b->n_words, n_stages = 1;
+	int n_args = 0, io_number = -1;
+
+	while(1)
+	{
+		if(p->tok == TOK_WORD)
+		{
+			if(new_word(b, W_ARG, -1, p->text) < 0)
+			{
+				return out_of_memory();
+			}
+			n_args++;
+		}
+		else if(p->tok == TOK_IO_NUMBER)
+		{
+			io_number = *p->text - '0';
+		}
+		else if(p->tok == TOK_REDIR)
+		{
+			enum redir_type type = p->redir;
+
+			advance(p);
+			if(p->tok != TOK_WORD)
+			{
+				return syntax_error(p);
+			}
+			if(io_number < 0)
+			{
+				io_number = (type == REDIR_IN || type == REDIR_STRING)
+					? 0 : 1;
+			}
+			if(new_word(b, W_REDIR + type, io_number, p->text) < 0)
+			{
+				return out_of_memory();
+			}
+			io_number = -1;
+		}
+		else if(p->tok == TOK_PIPE && n_args > 0 && n_stages < UINT16_MAX)
+		{
+			if(new_word(b, W_PIPE, -1, "") < 0)
+			{
+				return out_of_memory();
+			}
+			n_stages++;
+			n_args = 0;
+			advance(p);
+			skip_newlines(p);
+			continue;
+		}
+		else
+		{
+			break;
+		}
+		advance(p);
+	}
+
+	if(n_args == 0)
+	{
+		return syntax_error(p);
+	}
+
+	*out = new_node(b, AST_CMD, first, b->n_words - first, 0);
+	if(*out == AST_NONE)
+	{
+		return out_of_memory();
+	}
+	b->nodes[*out].n_stages = n_stages;
+	return 0;
+}
+
+
+/*
+ *	parse_pipeline
+ *
+ *	Details:
+ *		- ["!"] followed by an if, a loop or a pipeline of simple
+ *		  commands; an if or a loop cannot be a pipeline stage
+ */
+static int parse_pipeline(struct parser *p, uint32_t *out)
+{
+	int negate = 0, ret;
+
+	if(is_keyword(p, "!"))
+	{
+		negate = 1;
+		advance(p);
+	}
+
+	if(at_list_end(p))
+	{
+		return syntax_error(p);
+	}
+
+	if(is_keyword(p, "if"))
+	{
+		ret = parse_if(p, out);
+	}
+	else if(is_keyword(p, "while") || is_keyword(p, "until"))
+	{
+		ret = parse_loop(p, out);
+	}
+	else
+	{
+		ret = parse_simple(p, out);
+	}
+
+	if(ret < 0)
+	{
+		return -1;
+	}
+	if(p->tok == TOK_PIPE)
+	{
+		return syntax_error(p);
+	}
+	if(negate)
+	{
+		p->b->nodes[*out].flags |= AST_NEGATE;
+	}
+	return 0;
+}
+
+
+/*
+ *	parse_and_or
+ *
+ *	Details:
+ *		- pipelines joined by "&&" and "||", left to right with equal
+ *		  precedence
+ */
+static int parse_and_or(struct parser *p, uint32_t *out)
+{
+	uint32_t left, right;
+
+	if(parse_pipeline(p, &left) < 0)
+	{
+		return -1;
+	}
+
+	while(p->tok == TOK_AND_IF || p->tok == TOK_OR_IF)
+	{
+		enum ast_type type = (p->tok == TOK_AND_IF) ? AST_AND : AST_OR;
+
+		advance(p);
+		skip_newlines(p);
+		if(parse_pipeline(p, &right) < 0)
+		{
+			return -1;
+		}
+		left = new_node(p->b, type, left, right, 0);
+		if(left == AST_NONE)
+		{
+			return out_of_memory();
+		}
+	}
+
+	*out = left;
+	return 0;
+}
+
+
+/*
+ *	parse_list
+ *
+ *	Details:
+ *		- and-or lists separated by ';', '&' or newlines, up to the end
+ *		  of the script or a reserved word that ends a list
+ *		- the nodes are chained through next, *first is AST_NONE for
+ *		  an empty list
+ *		- '&' runs the command before it in the background, an if or
+ *		  a loop cannot be put in the background
+ */
+static int parse_list(struct parser *p, uint32_t *first)
+{
+	uint32_t node, prev = AST_NONE;
+
+	*first = AST_NONE;
+	skip_newlines(p);
+	while(!at_list_end(p))
+	{
+		if(parse_and_or(p, &node) < 0)
+		{
+			return -1;
+		}
+
+		if(prev == AST_NONE)
+		{
+			*first = node;
+		}
+		else
+		{
+			p->b->nodes[prev].next = node;
+		}
+		prev = node;
+
+		if(p->tok == TOK_AMP && p->b->nodes[node].type == AST_CMD)
+		{
+			p->b->nodes[node].flags |= AST_BACKGROUND;
+			advance(p);
+		}
+		else if(p->tok == TOK_SEMI)
+		{
+			advance(p);
+		}
+		else if(p->tok != TOK_NEWLINE && !at_list_end(p))
+		{
+			return syntax_error(p);
+		}
+		skip_newlines(p);
+	}
+
+	return 0;
+}
+
+
+/*
+ *	script_parse
+ *
+ *	Details:
+ *		- parses text (modified in place by the lexer) into s, the
+ *		  nodes, words and strings are packed into one buffer behind a
+ *		  struct script_header, the layout of the cache file
+ *		- name is used in error messages
+ *
+ *	Return value
+ *		- 0 on success, -1 on a syntax error or if out of memory
+ */
+int script_parse(char *text, const char *name, struct script *s)
+{
+	struct ast_builder b = { NULL };
+	struct parser p = { { text, 0, 1, 0 } };
+	struct script_header *hdr;
+	uint32_t root;
+	size_t size;
+	int ret = -1;
+
+	p.name = name;
+	p.b = &b;
+	advance(&p);
+	if(parse_list(&p, &root) < 0)
+	{
+		goto out;
+	}
+	if(p.tok != TOK_END)
+	{
+		syntax_error(&p);
+		goto out;
+	}
+
+	size = sizeof(*hdr) + b.n_nodes * sizeof(struct ast_node)
+		+ b.n_words * sizeof(struct ast_word) + b.pool_size;
+	hdr = calloc(1, size);
+	if(!hdr)
+	{
+		out_of_memory();
+		goto out;
+	}
+
+	memcpy(hdr->magic, script_magic, sizeof(hdr->magic));
+	hdr->n_nodes = b.n_nodes;
+	hdr->n_words = b.n_words;
+	hdr->pool_size = b.pool_size;
+	hdr->root = root;
+	s->hdr = hdr;
+	s->size = size;
+	s->mapped = 0;
+	s->nodes = (struct ast_node *)(hdr + 1);
+	s->words = (struct ast_word *)(s->nodes + b.n_nodes);
+	s->pool = (char *)(s->words + b.n_words);
+	memcpy(s->nodes, b.nodes, b.n_nodes * sizeof(struct ast_node));
+	memcpy(s->words, b.words, b.n_words * sizeof(struct ast_word));
+	memcpy(s->pool, b.pool, b.pool_size);
+	ret = 0;
+
+out:
+	free(b.nodes);
+	free(b.words);
+	free(b.pool);
+	return ret;
+}
+
+
+/*
+ *	cache_path
+ *
+ *	Details:
+ *		- the cache entry of the file behind st is named after its
+ *		  device and inode, in $XDG_CACHE_HOME/my_shell or under
+ *		  $HOME (SCRIPT_CACHE_DIR)
+ *		- with mkdirs set, the directories are created
+ *
+ *	Return value
+ *		- 0 on success, -1 if there is no cache directory
+ */
+static int cache_path(char *path, const struct stat *st, int mkdirs)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *dir = "my_shell";
+	int n;
+
+	if(!base || !*base)
+	{
+		base = getenv("HOME");
+		dir = SCRIPT_CACHE_DIR;
+	}
+	if(!base)
+	{
+		return -1;
+	}
+
+	n = snprintf(path, PATH_MAX, "%s/%s", base, dir);
+	if(n >= PATH_MAX)
+	{
+		return -1;
+	}
+
+	/* mkdir -p */
+	for(char *p = path + 1; mkdirs && p; )
+	{
+		p = strchr(p, '/');
+		if(p)
+		{
+			*p = '\0';
+		}
+		if(mkdir(path, 0700) < 0 && errno != EEXIST)
+		{
+			return -1;
+		}
+		if(p)
+		{
+			*p++ = '/';
+		}
+	}
+
+	n += snprintf(path + n, PATH_MAX - n, "/%llx-%llx",
+			(unsigned long long)st->st_dev,
+			(unsigned long long)st->st_ino);
+	return (n >= PATH_MAX) ? -1 : 0;
+}
+
+
+/*
+ *	count_stages
+ *
+ *	Details:
+ *		- counts the stages of the n words of an AST_CMD, as run_cmd
+ *		  splits them at W_PIPE words
+ *
+ *	Return value
+ *		- number of stages, 0 if a stage has no argument (a W_PIPE
+ *		  first, last or next to another one)
+ */
+static uint32_t count_stages(const struct ast_word *w, uint32_t n)
+{
+	uint32_t n_stages = 1;
+	int n_args = 0;
+
+	for(uint32_t i = 0; i < n; i++, w++)
+	{
+		if(w->kind == W_ARG)
+		{
+			n_args++;
+		}
+		else if(w->kind == W_PIPE)
+		{
+			if(n_args == 0)
+			{
+				return 0;
+			}
+			n_stages++;
+			n_args = 0;
+		}
+	}
+
+	return (n_args == 0) ? 0 : n_stages;
+}
+
+
+/*
+ *	script_check
+ *
+ *	Details:
+ *		- sets up s for the buffer hdr of size bytes and checks that
+ *		  every index and offset in it is in range, children come
+ *		  before their parent and a next node after it, and every
+ *		  AST_CMD splits into n_stages stages of at least one argument,
+ *		  so a damaged cache file can neither crash nor loop the shell
+ *
+ *	Return value
+ *		- 0 if the buffer holds a valid script, -1 otherwise
+ */
+static int script_check(struct script *s, struct script_header *hdr,
+		size_t size)
+{
+	if(size < sizeof(*hdr) || size != sizeof(*hdr)
+			+ (size_t)hdr->n_nodes * sizeof(struct ast_node)
+			+ (size_t)hdr->n_words * sizeof(struct ast_word)
+			+ hdr->pool_size)
+	{
+		return -1;
+	}
+	if(hdr->n_nodes == AST_NONE || (hdr->root != AST_NONE
+			&& hdr->root >= hdr->n_nodes))
+	{
+		return -1;
+	}
+
+	s->hdr = hdr;
+	s->size = size;
+	s->nodes = (struct ast_node *)(hdr + 1);
+	s->words = (struct ast_word *)(s->nodes + hdr->n_nodes);
+	s->pool = (char *)(s->words + hdr->n_words);
+
+	if(hdr->pool_size && s->pool[hdr->pool_size - 1] != '\0')
+	{
+		return -1;
+	}
+
+	for(uint32_t i = 0; i < hdr->n_words; i++)
+	{
+		const struct ast_word *w = &s->words[i];
+
+		if(w->str >= hdr->pool_size || w->kind > W_REDIR + REDIR_STRING
+				|| (w->kind >= W_REDIR
+					&& (w->fd < 0 || w->fd >= REDIR_FD_MIN)))
+		{
+			return -1;
+		}
+	}
+
+	for(uint32_t i = 0; i < hdr->n_nodes; i++)
+	{
+		const struct ast_node *n = &s->nodes[i];
+
+		if(n->type >= AST_TYPES
+				|| (n->next != AST_NONE
+					&& (n->next <= i || n->next >= hdr->n_nodes)))
+		{
+			return -1;
+		}
+
+		if(n->type == AST_CMD)
+		{
+			if((uint64_t)n->a + n->b > hdr->n_words || n->n_stages
+					!= count_stages(s->words + n->a, n->b))
+			{
+				return -1;
+			}
+		}
+		else if(n->a >= i || n->b >= i
+				|| (n->type == AST_IF && n->c != AST_NONE && n->c >= i))
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ *	cache_open
+ *
+ *	Details:
+ *		- maps the cache entry of the script behind st, if it was
+ *		  parsed from the same file (device, inode, mtime and size)
+ *		- the mapping is private and writable, so argv strings can
+ *		  be handed to commands like the ones of a parsed line
+ *
+ *	Return value
+ *		- 0 if s now holds the cached script, -1 otherwise
+ */
+static int cache_open(const char *path, const struct stat *st,
+		struct script *s)
+{
+	struct script_header *hdr;
+	struct stat cst;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+	{
+		return -1;
+	}
+	if(fstat(fd, &cst) < 0 || (size_t)cst.st_size < sizeof(*hdr))
+	{
+		close(fd);
+		return -1;
+	}
+
+	hdr = mmap(NULL, cst.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			fd, 0);
+	close(fd);
+	if(hdr == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	if(memcmp(hdr->magic, script_magic, sizeof(hdr->magic)) != 0
+			|| hdr->dev != (uint64_t)st->st_dev
+			|| hdr->ino != (uint64_t)st->st_ino
+			|| hdr->mtime_sec != st->st_mtim.tv_sec
+			|| hdr->mtime_nsec != st->st_mtim.tv_nsec
+			|| hdr->size != (uint64_t)st->st_size
+			|| script_check(s, hdr, cst.st_size) < 0)
+	{
+		munmap(hdr, cst.st_size);
+		return -1;
+	}
+
+	s->mapped = 1;
+	return 0;
+}
+
+
+/*
+ *	cache_write
+ *
+ *	Details:
+ *		- writes s as the cache entry of the script behind st
+ *		- the entry is written to a temporary file and renamed into
+ *		  place, so shells running the script at the same time only
+ *		  ever map complete entries
+ *		- a cache that cannot be written is not an error, the script
+ *		  is parsed again next time
+ */
+static void cache_write(const struct stat *st, struct script *s)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 16];
+	const char *p = (const char *)s->hdr;
+	size_t left = s->size;
+	int fd;
+
+	if(cache_path(path, st, 1) < 0)
+	{
+		return;
+	}
+
+	s->hdr->dev = st->st_dev;
+	s->hdr->ino = st->st_ino;
+	s->hdr->mtime_sec = st->st_mtim.tv_sec;
+	s->hdr->mtime_nsec = st->st_mtim.tv_nsec;
+	s->hdr->size = st->st_size;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if(fd < 0)
+	{
+		return;
+	}
+
+	while(left > 0)
+	{
+		ssize_t n = write(fd, p, left);
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n <= 0)
+		{
+			break;
+		}
+		p += n;
+		left -= n;
+	}
+
+	if(close(fd) < 0 || left > 0 || rename(tmp, path) < 0)
+	{
+		unlink(tmp);
+	}
+}
+
+
+/*
+ *	script_load
+ *
+ *	Details:
+ *		- loads the script file path into s, from the cache if it holds
+ *		  an entry for the file as it is now, otherwise by reading and
+ *		  parsing the file and writing a new cache entry
+ *
+ *	Return value
+ *		- 0 on success
+ *		- -1 if the file cannot be read (errno is set)
+ *		- -2 on a syntax error
+ */
+int script_load(const char *path, struct script *s)
+{
+	char cpath[PATH_MAX], *text;
+	struct stat st;
+	size_t len = 0;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	if(fstat(fd, &st) < 0)
+	{
+		goto fail;
+	}
+
+	if(cache_path(cpath, &st, 0) == 0 && cache_open(cpath, &st, s) == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	text = malloc(st.st_size + 1);
+	if(!text)
+	{
+		goto fail;
+	}
+	while(len < (size_t)st.st_size)
+	{
+		ssize_t n = read(fd, text + len, st.st_size - len);
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n < 0)
+		{
+			free(text);
+			goto fail;
+		}
+		if(n == 0)
+		{
+			break;
+		}
+		len += n;
+	}
+	text[len] = '\0';
+	close(fd);
+
+	if(script_parse(text, path, s) < 0)
+	{
+		free(text);
+		return -2;
+	}
+	free(text);
+
+	/* a file that changed while it was read must not be cached */
+	if(len == (size_t)st.st_size)
+	{
+		cache_write(&st, s);
+	}
+	return 0;
+
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+
+/*
+ *	run_cmd
+ *
+ *	Details:
+ *		- turns an AST_CMD back into the struct cmd_line parse_cmd
+ *		  would have produced and runs it with exec_line, the argv
+ *		  strings point into the string pool
+ */
+static int run_cmd(struct script *s, const struct ast_node *n)
+{
+	const struct ast_word *w = s->words + n->a;
+	struct redir **tail;
+	struct cmd_line cmd;
+	char **argv;
+	int n_args = 0;
+
+	jobs_notify(0);
+	arena_reset(&arena);
+
+	argv = arena_alloc(&arena, (n->b + 1) * sizeof(char *));
+	cmd.stages = arena_alloc(&arena, n->n_stages * sizeof(char **));
+	cmd.redirs = arena_alloc(&arena, n->n_stages * sizeof(struct redir *));
+	if(!argv || !cmd.stages || !cmd.redirs)
+	{
+		return out_of_memory();
+	}
+
+	cmd.n_stages = 0;
+	cmd.background = (n->flags & AST_BACKGROUND) != 0;
+	cmd.stages[0] = argv;
+	cmd.redirs[0] = NULL;
+	tail = &cmd.redirs[0];
+	for(uint32_t i = 0; i < n->b; i++, w++)
+	{
+		struct redir *r;
+
+		if(w->kind == W_ARG)
+		{
+			argv[n_args++] = s->pool + w->str;
+			continue;
+		}
+
+		if(w->kind == W_PIPE)
+		{
+			argv[n_args++] = NULL;
+			cmd.stages[++cmd.n_stages] = argv + n_args;
+			cmd.redirs[cmd.n_stages] = NULL;
+			tail = &cmd.redirs[cmd.n_stages];
+			continue;
+		}
+
+		r = arena_alloc(&arena, sizeof(*r));
+		if(!r)
+		{
+			return out_of_memory();
+		}
+		r->fd = w->fd;
+		r->type = w->kind - W_REDIR;
+		r->target = s->pool + w->str;
+		r->src = -1;
+		r->next = NULL;
+		*tail = r;
+		tail = &r->next;
+	}
+	argv[n_args] = NULL;
+	cmd.n_stages++;
+
+	return exec_line(&cmd);
+}
+
+
+static int run_list(struct script *s, uint32_t i);
+
+
+/*
+ *	run_node
+ *
+ *	Details:
+ *		- runs one node of the script, the status of an if is the
+ *		  status of the list it ran (0 if none), the status of a loop
+ *		  the status of the last run of its body (0 if none)
+ *
+ *	Return value
+ *		- exit status of the node
+ */
+static int run_node(struct script *s, uint32_t i)
+{
+	const struct ast_node *n = &s->nodes[i];
+	int status = 0;
+
+	switch(n->type)
+	{
+		case AST_CMD:
+			status = run_cmd(s, n);
+			if(status == 128 + SIGINT)
+			{
+				interrupted = 1;
+			}
+			break;
+
+		case AST_AND:
+		case AST_OR:
+			status = run_node(s, n->a);
+			if(!interrupted && (status == 0) == (n->type == AST_AND))
+			{
+				status = run_node(s, n->b);
+			}
+			break;
+
+		case AST_IF:
+			if(run_list(s, n->a) == 0)
+			{
+				status = run_list(s, n->b);
+			}
+			else if(n->c != AST_NONE)
+			{
+				status = run_list(s, n->c);
+			}
+			break;
+
+		case AST_WHILE:
+		case AST_UNTIL:
+			while((run_list(s, n->a) == 0) == (n->type == AST_WHILE)
+					&& !interrupted)
+			{
+				status = run_list(s, n->b);
+			}
+			break;
+	}
+
+	if(n->flags & AST_NEGATE)
+	{
+		status = !status;
+	}
+	last_status = status;
+	return status;
+}
+
+
+static int run_list(struct script *s, uint32_t i)
+{
+	int status = 0;
+
+	for(; i != AST_NONE && !interrupted; i = s->nodes[i].next)
+	{
+		status = run_node(s, i);
+	}
+
+	return status;
+}
+
+
+/*
+ *	script_run
+ *
+ *	Details:
+ *		- runs a script loaded by script_load or script_parse, a
+ *		  command killed by SIGINT ends it
+ *
+ *	Return value
+ *		- exit status of the last command
+ */
+int script_run(struct script *s)
+{
+	interrupted = 0;
+	return run_list(s, s->hdr->root);
+}
@@ -5,10 +5,25 @@
 #include <stdlib.h>		/* getenv() */
 #include <unistd.h>		/* getcwd(), chdir() */
 #include <inttypes.h>		/* uint8_t */
-#include <sys/wait.h>		/* wait() */
+#include <fcntl.h>		/* O_CLOEXEC */
+#include <signal.h>		/* sigset_t */
+#include <poll.h>		/* poll() */
+#include <sys/wait.h>		/* waitpid() */
+#ifdef SPAWN
+#include <spawn.h>		/* posix_spawn() */
+#endif
 
 #include "shell.h"
 
+/* set when commands are read from a terminal, enables banner and prompt */
+static int interactive;
+
+/* exit status of the last command, returned when the shell exits */
+int last_status;
+
+/* set when the prompt has to be rebuilt */
+static int prompt_stale;
+
 
 /*
  *	init_shell
@@ -37,30 +52,37 @@ void init_shell()
  *	print_cwd()
  *
  *	Details:
- *		- prints user name and the current working directory
+ *		- prints the prompt: user name and the current working
+ *		  directory
+ *		- the prompt is built once and only rebuilt after "cd", so
+ *		  showing it does not touch the file system (which may be a
+ *		  slow network mount) or the environment
  */
 void print_cwd()
 {	
-	char *value = getenv("USER");
-#ifdef COLOR		
-	green();
-#endif		
-	printf("%s", value);
-#ifdef COLOR	
-	white();
-#endif	
-	printf(":");
+	static char *prompt;
+
+	if(!prompt || prompt_stale)
+	{
+		char *cur_dir_path = get_current_dir_name();
+
+		free(prompt);
+		if(asprintf(&prompt,
 #ifdef COLOR
-	blue();
-#endif
-	char *cur_dir_path = get_current_dir_name();
-	printf("%s", cur_dir_path);
-#ifdef COLOR	
-	white();
+				"\033[1m\033[32m%s\x1B[0m:\033[1m\033[34m%s\x1B[0m>> ",
+#else
+				"%s:%s>> ",
 #endif
-	printf(">> ");
+				getenv("USER"), cur_dir_path) < 0)
+		{
+			prompt = NULL;
+		}
+		free(cur_dir_path);
+		prompt_stale = 0;
+	}
 
-	free(cur_dir_path);
+	fputs(prompt ? prompt : ">> ", stdout);
+	fflush(stdout);
 }
 
 
@@ -68,266 +90,712 @@ void print_cwd()
  *	take_input
  *
  *	Details:
- *		- reads an entire line from stdin
+ *		- reads an entire line from input into a buffer that is reused
+ *		  (and grown by getline when needed) for every line
  *
  *	Return value
- *		- 0, if command read from stdin
- *		- 1, else
+ *		- the line, or NULL on end of input
  */
-int take_input(char *str)
+char *take_input(FILE *input)
 {	
-	char *buffer = NULL;
-	size_t len = 0;
+	static char *buffer = NULL;
+	static size_t len = 0;
 	
-	ssize_t ori_len = getline(&buffer, &len, stdin);
-	if(ori_len > 1)
+	if(getline(&buffer, &len, input) < 0)
 	{
-		strcpy(str, buffer);
-		return 0;
+		return NULL;
 	}
-	else
-	{
-		return 1;	
-	}	
+
+	return buffer;
 }
 
 
 /*
- *	parse_cmd
+ *	wait_input - the input loop of an interactive shell
  *
  *	Details:
- *		- parses string read by 'take_input' command
- *		- if pipe encountered, args after pipe stored separately
+ *		- polls the terminal and the SIGCHLD signalfd (jobs_event_fd)
+ *		  together, SIGCHLD is blocked meanwhile so it is delivered
+ *		  through the descriptor instead of the handler
+ *		- background jobs that finish while the shell waits for input
+ *		  are reported right away, followed by a new prompt; a half
+ *		  typed line stays in the terminal and is read once finished
+ *		- reads the terminal with read() into a buffer of its own, a
+ *		  line is returned once its newline arrived
+ *		- never reads past that newline, so input typed ahead stays in
+ *		  the terminal for the command, or a builtin like parallel,
+ *		  that reads stdin next: in canonical mode the terminal returns
+ *		  at most one line per read(), in any other mode it is read one
+ *		  byte at a time
  *
- * 	Return Value:
- *		-  1, if pipe present
- *		-  0, if no pipe present
- *		- -1, if argument count exceeds MAX_ARGS
+ *	Return value
+ *		- the line, or NULL on end of input
  */
-int parse_cmd(char *str, char **parsed_args, char **parsed_args_after_pipe)
-{	
-	char *token;
-	uint8_t pipe_flag = 0;
-	int arg_ind = 0;
-	
-	token = strtok(str, " '\n'");
+char *wait_input(void)
+{
+	static char *buffer = NULL;
+	static size_t size = 0, len = 0, used = 0;
+	struct pollfd fds[2] =
+	{
+		{ STDIN_FILENO, POLLIN, 0 },
+		{ jobs_event_fd(), POLLIN, 0 },
+	};
+	char *line = NULL, *nl;
+	struct termios tmodes;
+	size_t chunk = 1;
+	sigset_t old;
+
+	/* drop the line returned last time */
+	if(used)
+	{
+		memmove(buffer, buffer + used, len - used);
+		len -= used;
+		used = 0;
+	}
+
+	if(tcgetattr(STDIN_FILENO, &tmodes) == 0 && (tmodes.c_lflag & ICANON))
+	{
+		chunk = BATCH_BUF_SIZE;
+	}
 
-	while(token != NULL)
+	sigchld_block(&old);
+	while(!line)
 	{
-		if(arg_ind == MAX_ARGS)
-		{	
-			printf("Too many arguments\n");
-			return -1;
+		ssize_t n;
+
+		nl = buffer ? memchr(buffer, '\n', len) : NULL;
+		if(nl)
+		{
+			*nl = '\0';
+			used = nl + 1 - buffer;
+			line = buffer;
+			break;
+		}
+
+		if(jobs_event() > 0)
+		{
+			printf("\n");
+			jobs_notify(1);
+			print_cwd();
 		}
 
-		if(*token == '|')
-		{	
-			pipe_flag = 1;
-			arg_ind = 0;
-			
-			token = strtok(NULL, " '\n'");
-			while(token != NULL)
+		if(poll(fds, 2, -1) < 0)
+		{
+			if(errno == EINTR)
 			{
-				if(arg_ind == MAX_ARGS)
-				{	
-					printf("Too many arguments\n");
-					return -1;
-				}
-				parsed_args_after_pipe[arg_ind] = (char *)malloc(strlen(token) + 1);
-				strcpy(parsed_args_after_pipe[arg_ind], token);
-				arg_ind++;		
-				token = strtok(NULL, " '\n'");
+				continue;
 			}
-
 			break;
 		}
-		else
+		if(!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+		{
+			continue;
+		}
+
+		if(size - len < BATCH_BUF_SIZE / 16)
+		{
+			char *p = realloc(buffer, size + BATCH_BUF_SIZE);
+
+			if(!p)
+			{
+				break;
+			}
+			buffer = p;
+			size += BATCH_BUF_SIZE;
+		}
+
+		n = read(STDIN_FILENO, buffer + len,
+				(chunk < size - len - 1) ? chunk : size - len - 1);
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n > 0)
+		{
+			len += n;
+			continue;
+		}
+
+		/* end of input, a last line without newline still counts */
+		if(len > 0)
 		{
-			parsed_args[arg_ind] = (char *)malloc(strlen(token) + 1);
-			strcpy(parsed_args[arg_ind], token);
-			arg_ind++;		
-			token = strtok(NULL, " '\n'");
+			buffer[len] = '\0';
+			used = len;
+			line = buffer;
 		}
+		break;
 	}
+	sigchld_restore(&old);
 
-	return pipe_flag;
+	return line;
 }
 
 
 /*
- *	exec_cmd - handler for "my own" as well as "non-piped" commands
+ *	print_exec_error
  *
  *	Details:
- *		- executes custom defined commands with switch statement
- *		- every other command not in the list is executed using execvp
+ *		- reports a command that could not be executed on stderr, so
+ *		  the message does not end up in the next pipeline stage
  */
-int exec_cmd(char **parsed_args)
-{	
-	char *my_commands[MY_COMMANDS];
-	my_commands[0] = "exit";
-	my_commands[1] = "clear";
-	my_commands[2] = "cd";
-	my_commands[3] = "help";
+void print_exec_error(const char *cmd, int err)
+{
+	if(err == ENOENT)
+	{
+		fprintf(stderr, "%s: command not found\n", cmd);
+	}
+	else
+	{
+		fprintf(stderr, "Error: cannot execute command %s (%s)\n",
+				cmd, strerror(err));
+	}
+}
 
-	pid_t execvp_pid;
-	
-	int command_no = 0;
-	for(int i = 0; i < MY_COMMANDS; i++)
-	{	
-		if(strcmp(my_commands[i], parsed_args[0]) == 0)
-		{	
-			command_no = i + 1;
-			break;
+
+/*
+ *	child_setup - prepares a forked child before it execs or runs a builtin
+ *
+ *	Details:
+ *		- joins process group pgid (0 starts a new one) unless pgid is
+ *		  -1, and takes the terminal for a foreground job; this races
+ *		  with the same calls in the parent, whichever runs first wins
+ *		- restores the signal dispositions and mask of the shell
+ *		- moves fd_in/fd_out onto stdin/stdout, then installs the
+ *		  redirections opened by the shell, which win over the pipes
+ */
+static void child_setup(int fd_in, int fd_out, struct redir *redirs,
+		pid_t pgid, int foreground)
+{
+	if(pgid >= 0)
+	{
+		setpgid(0, pgid);
+		if(foreground)
+		{
+			tcsetpgrp(STDIN_FILENO, getpgrp());
 		}
 	}
+	child_reset_signals();
 
-	switch(command_no)
+	if(fd_in != STDIN_FILENO)
 	{
-		case 1:
-			printf("exiting shell...\n");
-			exit(0);
+		dup2(fd_in, STDIN_FILENO);
+	}
+	if(fd_out != STDOUT_FILENO)
+	{
+		dup2(fd_out, STDOUT_FILENO);
+	}
+	if(redir_apply(redirs) < 0)
+	{
+		_exit(1);
+	}
+}
 
-		case 2:
-			clear();
-			return 1;
 
-		case 3:
-			chdir(parsed_args[1]);
-			return 1;
+/*
+ *	sh_argv
+ *
+ *	Details:
+ *		- fills sh_args with the argv that runs the script path through
+ *		  SHELL_PATH: the shell, path, then the n_args - 1 arguments of
+ *		  parsed_args after its command name and the NULL
+ */
+static void sh_argv(char **sh_args, const char *path, char **parsed_args,
+		size_t n_args)
+{
+	sh_args[0] = SHELL_PATH;
+	sh_args[1] = (char *)path;
+	memcpy(sh_args + 2, parsed_args + 1, n_args * sizeof(char *));
+}
 
-		case 4:
-			printf("available commands:\n");
-			for(int i = 0; i < MY_COMMANDS; i++)
-			{
-				printf("\t %d. %s\n", i + 1, my_commands[i]);
-			}
-			return 1;
 
-		default:
-			execvp_pid = fork();			;
-			if(!execvp_pid)
-			{
-				execvp(parsed_args[0], parsed_args);
-				printf("%s: command not found\n", parsed_args[0]);
-				exit(0);
-			}
-			wait(NULL);
-			break;			
+/*
+ *	launch_cmd - starts an external command
+ *
+ *	Details:
+ *		- runs parsed_args with fd_in and fd_out as its stdin/stdout
+ *		  and the redirections of redirs, already opened by redir_open
+ *		- fd_in/fd_out are expected to be O_CLOEXEC, only their
+ *		  copies on stdin/stdout survive the exec
+ *		- pgid and foreground are passed on to child_setup
+ *		- the executable is looked up in the PATH cache (path_hash.c),
+ *		  a cached path that fails with ENOENT is forgotten and looked
+ *		  up once more
+ *		- built with -DSPAWN, the child is started with posix_spawn,
+ *		  which shares the address space of the shell until the exec
+ *		  (vfork semantics) instead of copying its page tables
+ *		- otherwise the child is started with fork + execv, and reports
+ *		  a failed exec back through an O_CLOEXEC pipe
+ *		- an executable the kernel cannot run (ENOEXEC, a script
+ *		  without "#!") is run by SHELL_PATH, as execvp does
+ *
+ *	Return value
+ *		- pid of the child, or -1 if it could not be started
+ */
+pid_t launch_cmd(char **parsed_args, int fd_in, int fd_out,
+		struct redir *redirs, pid_t pgid, int foreground)
+{
+	size_t n_args = 0;
+	const char *path;
+	int retried = 0, err = 0;
+	pid_t pid = -1;
+#ifdef SPAWN
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t set;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+	if(pgid >= 0)
+	{
+		posix_spawnattr_setpgroup(&attr, pgid);
+#if __GLIBC_PREREQ(2, 35)
+		if(foreground)
+		{
+			posix_spawn_file_actions_addtcsetpgrp_np(&actions,
+					STDIN_FILENO);
+		}
+#endif
+	}
+	if(fd_in != STDIN_FILENO)
+	{
+		posix_spawn_file_actions_adddup2(&actions, fd_in, STDIN_FILENO);
+	}
+	if(fd_out != STDOUT_FILENO)
+	{
+		posix_spawn_file_actions_adddup2(&actions, fd_out, STDOUT_FILENO);
+	}
+	for(struct redir *r = redirs; r; r = r->next)
+	{
+		posix_spawn_file_actions_adddup2(&actions, r->src, r->fd);
+	}
+
+	sigemptyset(&set);
+	posix_spawnattr_setsigmask(&attr, &set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGQUIT);
+	sigaddset(&set, SIGTSTP);
+	sigaddset(&set, SIGTTIN);
+	sigaddset(&set, SIGTTOU);
+	sigaddset(&set, SIGCHLD);
+	posix_spawnattr_setsigdefault(&attr, &set);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK
+			| POSIX_SPAWN_SETSIGDEF
+			| (pgid >= 0 ? POSIX_SPAWN_SETPGROUP : 0));
+#else
+	int err_pipe[2];
+#endif
+
+	/* the child must not inherit (or miss) buffered output */
+	fflush(stdout);
+
+	while(parsed_args[n_args])
+	{
+		n_args++;
+	}
+	/* SHELL_PATH path args..., filled in on ENOEXEC */
+	char *sh_args[n_args + 2];
+
+retry:
+	path = path_lookup(parsed_args[0]);
+	if(!path)
+	{
+		err = ENOENT;
+		goto out;
 	}
 
+#ifdef SPAWN
+	err = posix_spawn(&pid, path, &actions, &attr, parsed_args, environ);
+	if(err == ENOEXEC)
+	{
+		sh_argv(sh_args, path, parsed_args, n_args);
+		err = posix_spawn(&pid, SHELL_PATH, &actions, &attr, sh_args,
+				environ);
+	}
+#else
+	if(pipe2(err_pipe, O_CLOEXEC) < 0)
+	{
+		err = errno;
+		goto out;
+	}
+
+	pid = fork();
+	if(pid < 0)
+	{
+		err = errno;
+		close(err_pipe[0]);
+		close(err_pipe[1]);
+		goto out;
+	}
+
+	if(pid == 0)
+	{
+		close(err_pipe[0]);
+		child_setup(fd_in, fd_out, redirs, pgid, foreground);
+
+		execv(path, parsed_args);
+		if(errno == ENOEXEC)
+		{
+			sh_argv(sh_args, path, parsed_args, n_args);
+			execv(SHELL_PATH, sh_args);
+			errno = ENOEXEC;
+		}
+		err = errno;
+		write(err_pipe[1], &err, sizeof(err));
+		_exit(127);
+	}
+
+	/* EOF on err_pipe means the exec went through */
+	close(err_pipe[1]);
+	while(read(err_pipe[0], &err, sizeof(err)) < 0 && errno == EINTR)
+	{
+	}
+	close(err_pipe[0]);
+	if(err)
+	{
+		waitpid(pid, NULL, 0);
+	}
+#endif
+
+	if(err == ENOENT && !retried && path_forget(parsed_args[0]))
+	{
+		retried = 1;
+		goto retry;
+	}
+
+out:
+#ifdef SPAWN
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+#endif
+	if(err)
+	{
+		print_exec_error(parsed_args[0], err);
+		return -1;
+	}
+
+	return pid;
+}
+
+
+/*
+ *	launch_stage - starts one command of a pipeline
+ *
+ *	Details:
+ *		- builtins that can run as a pipeline stage are run in a
+ *		  forked child, without an exec, with fd_in/fd_out as
+ *		  stdin/stdout and every other descriptor closed
+ *		- everything else is started by launch_cmd
+ *
+ *	Return value
+ *		- pid of the child, or -1 if it could not be started
+ */
+pid_t launch_stage(char **parsed_args, int fd_in, int fd_out,
+		struct redir *redirs, pid_t pgid, int foreground)
+{
+	const struct builtin *b = builtin_find(parsed_args[0]);
+	pid_t pid;
+
+	if(!b || !(b->flags & BUILTIN_STAGE))
+	{
+		return launch_cmd(parsed_args, fd_in, fd_out, redirs, pgid,
+				foreground);
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if(pid < 0)
+	{
+		printf("unable to fork!\n");
+		return -1;
+	}
+
+	if(pid == 0)
+	{
+		int status;
+
+		child_setup(fd_in, fd_out, redirs, pgid, foreground);
+		/* there is no exec to drop the O_CLOEXEC pipe ends of the
+		 * other stages, a write end left open would hide EOF */
+		close_range(3, ~0U, 0);
+		status = b->fn(parsed_args);
+		fflush(stdout);
+		_exit(status);
+	}
+
+	return pid;
+}
+
+
+/*
+ *	wait_status - converts a waitpid status to a shell exit status
+ */
+int wait_status(int status)
+{
+	if(WIFSIGNALED(status))
+	{
+		return 128 + WTERMSIG(status);
+	}
+
+	return WEXITSTATUS(status);
+}
+
+
+/*
+ *	exit_cmd, clear_cmd, cd_cmd - builtins that need the shell itself
+ */
+int exit_cmd(char **parsed_args)
+{
+	if(interactive)
+	{
+		printf("exiting shell...\n");
+	}
+	exit(parsed_args[1] ? atoi(parsed_args[1]) : last_status);
+}
+
+int clear_cmd(char **parsed_args)
+{
+	clear();
+	return 0;
+}
+
+int cd_cmd(char **parsed_args)
+{
+	if(chdir(parsed_args[1] ? parsed_args[1] : getenv("HOME")) < 0)
+	{
+		fprintf(stderr, "cd: %s\n", strerror(errno));
+		return 1;
+	}
+
+	prompt_stale = 1;
 	return 0;
 }
 
 
+/*
+ *	exec_cmd - handler for "my own" as well as "non-piped" commands
+ *
+ *	Details:
+ *		- runs a builtin (builtin.c) in the shell process, without a
+ *		  fork
+ *		- every other command, and a builtin that can run as a stage
+ *		  when it is put in the background, is run by exec_pipe_cmd
+ *		  as a pipeline of one stage
+ *		- redirections of a builtin are applied to the shell itself
+ *		  and undone when it returns
+ *		- while timing is on, the run time of a builtin is recorded as
+ *		  a command latency sample
+ */
+int exec_cmd(char **parsed_args, struct redir *redirs, int background)
+{	
+	const struct builtin *b = builtin_find(parsed_args[0]);
+	long long t_start;
+	int saved[REDIR_FD_MIN];
+
+	if(!b || !(b->flags & BUILTIN_SHELL)
+			|| (background && (b->flags & BUILTIN_STAGE)))
+	{
+		exec_pipe_cmd(&parsed_args, &redirs, 1, background);
+		return 0;
+	}
+
+	t_start = stats_timing ? clock_ns() : 0;
+	if(redirs)
+	{
+		if(redir_open(redirs) < 0)
+		{
+			last_status = 1;
+			return 1;
+		}
+		redir_save(redirs, saved);
+		last_status = (redir_apply(redirs) < 0) ? 1
+			: b->fn(parsed_args);
+		redir_restore(saved);
+		redir_close(redirs);
+	}
+	else
+	{
+		last_status = b->fn(parsed_args);
+	}
+
+	if(t_start)
+	{
+		stats_record(STAT_CMD, clock_ns() - t_start);
+	}
+	return 1;
+}
+
+
 /*
  *	exec_pipe_cmd - handler for "piped" commands
  *	
  *	Details:
- *		- forks 2 child processes with pids child_1 and child_2
- *		- child_1 executes commands before pipe and child_2 executes
- *		  commands after pipe
- *		- the parent process waits until both child processes terminate
+ *		- creates all n_stages - 1 pipes up front
+ *		- launches one child per stage, stage i reads from pipe i - 1
+ *		  and writes to pipe i, so every stage runs concurrently
+ *		- pipes are created with O_CLOEXEC, children only keep the
+ *		  ends dup2'ed onto stdin/stdout across the exec
+ *		- pipes are grown to the capacity set with "pipesz", if any
+ *		- the stages form one job (jobs.c), in its own process group
+ *		  when the shell has job control
+ *		- the parent closes its copies of the pipes, then waits for a
+ *		  foreground job or reports the job number of a background one;
+ *		  SIGCHLD stays blocked from the first launch until the job is
+ *		  in the job table, so no exit can be missed
+ *		- while timing is on, every launch is recorded as a fork/exec
+ *		  overhead sample and a foreground job as a command latency
+ *		  sample; with timing off the hooks only test stats_timing
+ *
+ *	Return value
+ *		- 0, on success
+ *		- -1, if a pipe or child could not be created
  */
-int exec_pipe_cmd(char** parsed_args, char** parsed_args_after_pipe)
+int exec_pipe_cmd(char ***stages, struct redir **redirs, int n_stages,
+		int background)
 {
-	int pipefd[2]; 
-    	pid_t child_1, child_2;
- 
-    	if (pipe2(pipefd, 0) < 0)
-	{
-        	printf("cannot create pipe, errno: %d\n", errno);
-        	return -1;
-    	}
-    	child_1 = fork();
-    	if (child_1 < 0)
-	{
-        	printf("unable to fork!\n");
-        	return -1;
-    	}
- 	
-    	if (child_1 == 0)
-    	{
-        	close(pipefd[0]);
-        	dup2(pipefd[1], STDOUT_FILENO);
-        	close(pipefd[1]);
- 
-        	if (execvp(parsed_args[0], parsed_args) < 0)
-        	{
-#ifdef COLOR
-        		red();
-#endif
-        		printf("Error: ");
-#ifdef COLOR
-        		white();
-#endif 
-            		printf("cannot execute command %s\n", parsed_args[0]);
-           		exit(0);
-        	}
-    	}
-    	else
-    	{	
-        	child_2 = fork();
- 
-        	if (child_2 < 0)
+	int pipefd[n_stages > 1 ? n_stages - 1 : 1][2];
+	long long t_start = stats_timing ? clock_ns() : 0;
+	int n_pipes = 0, ret = 0;
+	struct job *job;
+	sigset_t old;
+
+	sigchld_block(&old);
+	job = job_create(stages, n_stages, n_stages, background);
+	if(!job)
+	{
+		sigchld_restore(&old);
+		printf("out of memory\n");
+		last_status = 127;
+		return -1;
+	}
+
+	for(n_pipes = 0; n_pipes < n_stages - 1; n_pipes++)
+	{
+		if(pipe2(pipefd[n_pipes], O_CLOEXEC) < 0)
 		{
-            		printf("unable to fork!\n");
-            		return -1;
-        	}
- 
-        	if (child_2 == 0)
-        	{	
-        	    	close(pipefd[1]);
-        	    	dup2(pipefd[0], STDIN_FILENO);
-        	    	close(pipefd[0]);
-        	    	if (execvp(parsed_args_after_pipe[0], parsed_args_after_pipe) < 0)
-        	    	{
-#ifdef COLOR
-        			red();
-#endif		
-      		  		printf("Error: ");
-#ifdef COLOR
-        			white();
-#endif    	
-            			printf("cannot execute command %s\n", parsed_args_after_pipe[0]);
-                		exit(0);
-            	    	}
-       		}
-        	else
-        	{	
-        		close(pipefd[0]);
-        		close(pipefd[1]);
-
-            		wait(NULL);
-           		wait(NULL);
-        	}
-    	}
-
-    	return 0;
+			printf("cannot create pipe, errno: %d\n", errno);
+			ret = -1;
+			goto close_pipes;
+		}
+		set_pipe_size(pipefd[n_pipes][1]);
+	}
+
+	for(int i = 0; i < n_stages; i++)
+	{
+		int fd_in = (i > 0) ? pipefd[i - 1][0] : STDIN_FILENO;
+		int fd_out = (i < n_stages - 1) ? pipefd[i][1] : STDOUT_FILENO;
+		long long t_launch = stats_timing ? clock_ns() : 0;
+		pid_t pid;
+
+		/* a stage that fails to start is skipped, its neighbours
+		 * see EOF/EPIPE once the parent closes the pipe ends */
+		if(redir_open(redirs[i]) < 0)
+		{
+			ret = -1;
+			continue;
+		}
+		pid = launch_stage(stages[i], fd_in, fd_out, redirs[i],
+				job_launch_pgid(job), !background);
+		redir_close(redirs[i]);
+		if(t_launch)
+		{
+			stats_record(STAT_LAUNCH, clock_ns() - t_launch);
+		}
+		if(pid < 0)
+		{
+			ret = -1;
+			continue;
+		}
+		job_add_process(job, pid);
+	}
+
+close_pipes:
+	for(int i = 0; i < n_pipes; i++)
+	{
+		close(pipefd[i][0]);
+		close(pipefd[i][1]);
+	}
+
+	/* the status of a pipeline is the status of its last stage */
+	if(job->n_procs == 0)
+	{
+		job_discard(job);
+		last_status = 127;
+	}
+	else if(background)
+	{
+		if(interactive)
+		{
+			printf("[%d] %d\n", job->id, job->procs[job->n_procs - 1].pid);
+		}
+		last_status = 0;
+	}
+	else
+	{
+		last_status = job_wait(job, 1, &old);
+		if(t_start)
+		{
+			stats_record(STAT_CMD, clock_ns() - t_start);
+		}
+	}
+	sigchld_restore(&old);
+
+	return ret;
 }
 
 
 /*
- *	free_args_mem
+ *	exec_line - runs a parsed command line
  *
  *	Details:
- *		- frees previously allocated memory by 'parse_cmd' function
+ *		- a line starting with "time" runs the rest of the line and
+ *		  reports what it cost (stats.c)
+ *		- a single stage goes to exec_cmd, so builtins run in the
+ *		  shell, a pipeline to exec_pipe_cmd
+ *
+ *	Return value
+ *		- exit status of the line
  */
-void free_args_mem(char** parsed_args, char** parsed_args_after_pipe, int pipe_flag)
+int exec_line(struct cmd_line *cmd)
 {
-	for(int i = 0; i < MAX_ARGS && parsed_args[i] != NULL; i++)
+	int n_stages = cmd->n_stages, timed;
+
+	/* "time" prefixes a command or pipeline, not a stage */
+	timed = (n_stages > 0 && strcmp(cmd->stages[0][0], "time") == 0);
+	if(timed)
+	{
+		time_begin();
+		if(!*++cmd->stages[0] && n_stages > 1)
+		{
+			fprintf(stderr, "syntax error near '|'\n");
+			n_stages = -1;
+		}
+		else if(!*cmd->stages[0])
+		{
+			n_stages = 0;
+		}
+	}
+
+	if(n_stages == 1)
 	{	
-		free(parsed_args[i]);
-		parsed_args[i] = 0;
+		exec_cmd(cmd->stages[0], cmd->redirs[0], cmd->background);
+	}
+	else if(n_stages > 1)
+	{
+		exec_pipe_cmd(cmd->stages, cmd->redirs, n_stages,
+				cmd->background);
+	}
+	else if(n_stages < 0)
+	{
+		last_status = 2;
 	}
 
-	if(pipe_flag)
+	if(timed)
 	{
-		for(int i = 0; i < MAX_ARGS && parsed_args_after_pipe[i] != NULL; i++)
-		{	
-			free(parsed_args_after_pipe[i]);
-			parsed_args_after_pipe[i] = 0;
-		}
+		time_end();
 	}
+
+	return last_status;
 }
 
 
@@ -335,40 +803,121 @@ void free_args_mem(char** parsed_args, char** parsed_args_after_pipe, int pipe_f
  *	main
  *	
  *	Details:
- *		- declares arrays to store and parse user commands
- *		- runs an infinite loop that parses and executes input commands
+ *		- owns the arena the parser takes argv arrays from, it is reset
+ *		  for every line
+ *		- picks the input source:
+ *		    my_shell -c 'cmd'	runs cmd as a script
+ *		    my_shell script	runs script, parsed once and cached
+ *					(script.c)
+ *		    my_shell		reads stdin line by line, interactively
+ *					on a terminal
+ *		- batch runs skip banner and prompt, and block-buffer input and
+ *		  output
+ *		- runs a loop that parses and executes input lines until end
+ *		  of input
+ *		- interactive lines go through "!" expansion and are appended
+ *		  to the history file (history.c); batch runs never open it
+ *
+ *	Return value
+ *		- exit status of the last command
  */
-int main()
+int main(int argc, char **argv)
 {
-	char user_command[MAX_COMMAND_LEN];
-	char *parsed_args[MAX_ARGS] = {0};
-	char *parsed_args_after_pipe[MAX_ARGS] = {0};
+	struct arena arena = { NULL };
+	struct script script;
+	struct cmd_line cmd;
+	FILE *input = stdin;
+	char *line;
 
-	int piped = 0;
-	
-	init_shell();
+	int n_stages = 0, ret = 0;
+
+	if(argc > 1 && strcmp(argv[1], "-c") == 0)
+	{
+		if(argc < 3)
+		{
+			fprintf(stderr, "usage: %s [-c command | script]\n", argv[0]);
+			return 2;
+		}
+		if(script_parse(argv[2], "-c", &script) < 0)
+		{
+			return 2;
+		}
+	}
+	else if(argc > 1)
+	{
+		ret = script_load(argv[1], &script);
+	}
+	else
+	{
+		interactive = isatty(STDIN_FILENO);
+	}
+
+	if(ret == -1)
+	{
+		fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], strerror(errno));
+		return 127;
+	}
+	if(ret < 0)
+	{
+		return 2;
+	}
+
+	jobs_init(interactive);
+	if(interactive)
+	{
+		history_init();
+		init_shell();
+	}
+	else
+	{
+		setvbuf(input, NULL, _IOFBF, BATCH_BUF_SIZE);
+		setvbuf(stdout, NULL, _IOFBF, BATCH_BUF_SIZE);
+	}
+
+	if(argc > 1)
+	{
+		return script_run(&script);
+	}
 
 	while(1)
 	{	
-		print_cwd();
+		jobs_notify(interactive);
+		if(interactive)
+		{
+			print_cwd();
+		}
 		
-		if(take_input(user_command))
+		line = interactive ? wait_input() : take_input(input);
+		if(!line)
 		{
-			continue;
+			break;
 		}
 
-		piped = parse_cmd(user_command, parsed_args, parsed_args_after_pipe);
-		if(piped == 0)
-		{	
-			exec_cmd(parsed_args);
+		if(interactive)
+		{
+			line = history_expand(line);
+			if(!line)
+			{
+				last_status = 1;
+				continue;
+			}
+			history_add(line);
 		}
-		else if(piped == 1)
+
+		arena_reset(&arena);
+		n_stages = parse_cmd(line, &arena, &cmd);
+		if(n_stages < 0)
 		{
-			exec_pipe_cmd(parsed_args, parsed_args_after_pipe);
+			last_status = 2;
+			continue;
 		}
+		exec_line(&cmd);
+	}
 
-		free_args_mem(parsed_args, parsed_args_after_pipe, piped);
+	if(interactive)
+	{
+		printf("\nexiting shell...\n");
 	}
 
-	return 0;
+	return last_status;
 }
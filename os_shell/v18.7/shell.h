@@ -1,9 +1,45 @@
 #ifndef _SHELL_H_
 #define _SHELL_H_
 
-#define MAX_COMMAND_LEN	100
-#define MAX_ARGS 10
-#define MY_COMMANDS 4
+#include <signal.h>		/* sigset_t */
+#include <termios.h>		/* struct termios */
+#include <sys/types.h>		/* pid_t */
+#include <sys/resource.h>	/* struct rusage */
+
+/* stdio buffer size for input and output of non-interactive runs */
+#define BATCH_BUF_SIZE 65536
+
+/* size of the first parser arena block */
+#define ARENA_MIN_SIZE 4096
+
+#define PATH_HASH_SIZE 64
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/* runs executables without a "#!" line, as execvp does */
+#define SHELL_PATH "/bin/sh"
+
+/* bytes moved per tee/splice call by the tee builtin */
+#define RELAY_CHUNK 65536
+
+/* finished "parallel" outputs held back beyond the running slots */
+#define PARALLEL_BACKLOG 64
+
+/* descriptors the shell opens redirection targets on, and one past the
+ * highest descriptor a redirection can name */
+#define REDIR_FD_MIN 10
+
+/* history file under $HOME unless $HISTFILE is set */
+#define HISTORY_FILE ".my_shell_history"
+/* new lines inserted one by one into the history index, more sort it */
+#define HISTORY_INSERT_MAX 64
+/* lines printed by "history" */
+#define HISTORY_SHOW 20
+
+/* script cache under $HOME unless $XDG_CACHE_HOME is set */
+#define SCRIPT_CACHE_DIR ".cache/my_shell"
+
+/* log2 latency buckets of "stats", the last one is open-ended */
+#define HIST_BUCKETS 32
 
 #define clear() printf("\033[H\033[J")
 
@@ -12,4 +48,277 @@
 #define blue()  printf("\033[1m\033[34m");
 #define white() printf("\x1B[0m");
 
+/*
+ *	struct arena - bump allocator the parser takes memory from
+ *
+ *	@head	: block allocations are currently taken from
+ */
+struct arena
+{
+	struct arena_block *head;
+};
+
+enum redir_type
+{
+	REDIR_IN,
+	REDIR_OUT,
+	REDIR_APPEND,
+	REDIR_DUP,
+	REDIR_STRING,
+};
+
+/*
+ *	struct redir - one redirection of a command
+ *
+ *	@fd	: descriptor of the command that is redirected
+ *	@type	: '<', '>', ">>", ">&"/"<&" or "<<<"
+ *	@target	: file name, descriptor number or here-string
+ *	@src	: descriptor the shell opened for target (-1 until then),
+ *		  dup2'ed onto fd in the child
+ *	@next	: next redirection, they are applied in the order written
+ */
+struct redir
+{
+	int fd;
+	enum redir_type type;
+	char *target;
+	int src;
+	struct redir *next;
+};
+
+/* a builtin runs in the shell process as a lone command */
+#define BUILTIN_SHELL	1
+/* a builtin runs in a forked child (without exec) as a pipeline stage */
+#define BUILTIN_STAGE	2
+
+/*
+ *	struct builtin - a command run by the shell without an exec
+ *
+ *	@name	: command name
+ *	@fn	: runs the command, returns its exit status
+ *	@flags	: BUILTIN_SHELL and/or BUILTIN_STAGE
+ */
+struct builtin
+{
+	const char *name;
+	int (*fn)(char **parsed_args);
+	int flags;
+};
+
+/*
+ *	struct lexer - state of the tokenizer (parse.c)
+ *
+ *	@pos		: next unread character of the text
+ *	@saved		: character at pos overwritten by the terminating NUL of
+ *			  the previous word, 0 if none
+ *	@multiline	: set for scripts, newlines are tokens
+ *	@line		: newlines read so far
+ */
+struct lexer
+{
+	char *pos;
+	char saved;
+	int multiline;
+	int line;
+};
+
+enum token_type
+{
+	TOK_END,
+	TOK_WORD,
+	TOK_PIPE,
+	TOK_AMP,
+	TOK_SEMI,
+	TOK_AND_IF,
+	TOK_OR_IF,
+	TOK_NEWLINE,
+	TOK_IO_NUMBER,
+	TOK_REDIR,
+	TOK_ERROR,
+};
+
+/*
+ *	struct script - a parsed script (script.c)
+ *
+ *	@hdr	: start of the buffer holding the script
+ *	@size	: size of the buffer
+ *	@mapped	: set if the buffer is a mapped cache file
+ *	@nodes	: nodes of the syntax tree
+ *	@words	: arguments and redirections of its commands
+ *	@pool	: their text
+ */
+struct script
+{
+	struct script_header *hdr;
+	size_t size;
+	int mapped;
+	struct ast_node *nodes;
+	struct ast_word *words;
+	char *pool;
+};
+
+/*
+ *	struct cmd_line - a parsed command line
+ *
+ *	@n_stages	: number of pipeline stages
+ *	@stages		: NULL-terminated argv of every stage
+ *	@redirs		: list of redirections of every stage
+ *	@background	: set if the line ends with '&'
+ */
+struct cmd_line
+{
+	int n_stages;
+	char ***stages;
+	struct redir **redirs;
+	int background;
+};
+
+/*
+ *	struct process - one process of a job
+ *
+ *	@pid		: process id
+ *	@state		: PROC_RUNNING, PROC_STOPPED or PROC_DONE
+ *	@status		: waitpid status once the process is done
+ *	@ru		: resource usage reported by wait4 once it is done
+ *	@start_ns	: clock_ns() when the process was added, 0 unless
+ *			  timing was on
+ *	@end_ns		: clock_ns() when a timed process was reaped
+ */
+struct process
+{
+	pid_t pid;
+	int state;
+	int status;
+	struct rusage ru;
+	long long start_ns;
+	long long end_ns;
+};
+
+enum proc_state
+{
+	PROC_RUNNING,
+	PROC_STOPPED,
+	PROC_DONE,
+};
+
+/* kinds of samples kept by "stats" */
+enum stat_kind
+{
+	STAT_CMD,
+	STAT_LAUNCH,
+	STAT_STAGE,
+	N_STATS,
+};
+
+/*
+ *	struct job - a pipeline started by the shell
+ *
+ *	@id		: job number shown as [id]
+ *	@pgid		: process group of the job, 0 until the first process is
+ *			  added or when job control is off
+ *	@n_procs	: processes added so far
+ *	@procs		: one entry per pipeline stage
+ *	@text		: command line, for "jobs"
+ *	@tmodes		: terminal modes saved when the job was stopped
+ *	@has_tmodes	: set once tmodes holds modes to restore on "fg"
+ *	@next		: next older job
+ */
+struct job
+{
+	int id;
+	pid_t pgid;
+	int n_procs;
+	struct process *procs;
+	char *text;
+	struct termios tmodes;
+	int has_tmodes;
+	struct job *next;
+};
+
+/* shell.c */
+extern int last_status;
+int wait_status(int status);
+int exec_line(struct cmd_line *cmd);
+pid_t launch_cmd(char **parsed_args, int fd_in, int fd_out,
+		struct redir *redirs, pid_t pgid, int foreground);
+int exec_pipe_cmd(char ***stages, struct redir **redirs, int n_stages,
+		int background);
+int exit_cmd(char **parsed_args);
+int clear_cmd(char **parsed_args);
+int cd_cmd(char **parsed_args);
+
+/* builtin.c */
+const struct builtin *builtin_find(const char *name);
+int help_cmd(char **parsed_args);
+
+/* parse.c */
+void *arena_alloc(struct arena *arena, size_t n);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+const char *token_name(enum token_type type);
+enum token_type next_token(struct lexer *lex, char **text,
+		enum redir_type *redir);
+int parse_cmd(char *line, struct arena *arena, struct cmd_line *cmd);
+
+/* path_hash.c */
+const char *path_lookup(const char *name);
+int path_forget(const char *name);
+void path_hash_clear(void);
+int hash_cmd(char **parsed_args);
+
+/* relay.c */
+void set_pipe_size(int fd);
+int pipesz_cmd(char **parsed_args);
+int tee_cmd(char **parsed_args);
+
+/* jobs.c */
+void jobs_init(int interactive);
+void sigchld_block(sigset_t *old);
+void sigchld_restore(const sigset_t *old);
+void child_reset_signals(void);
+struct job *job_create(char ***stages, int n_stages, int n_procs,
+		int background);
+void job_add_process(struct job *job, pid_t pid);
+pid_t job_launch_pgid(struct job *job);
+int job_wait(struct job *job, int foreground, const sigset_t *old);
+void job_discard(struct job *job);
+int jobs_event_fd(void);
+int jobs_event(void);
+void jobs_notify(int verbose);
+int jobs_cmd(char **parsed_args);
+int fg_cmd(char **parsed_args);
+int bg_cmd(char **parsed_args);
+int wait_cmd(char **parsed_args);
+
+/* parallel.c */
+int parallel_cmd(char **parsed_args);
+
+/* stats.c */
+extern int stats_timing;
+long long clock_ns(void);
+void stats_record(enum stat_kind kind, long long ns);
+void stats_job_done(struct job *job);
+void time_begin(void);
+void time_end(void);
+int stats_cmd(char **parsed_args);
+
+/* redirect.c */
+int redir_open(struct redir *list);
+void redir_close(struct redir *list);
+int redir_apply(struct redir *list);
+void redir_save(struct redir *list, int saved[REDIR_FD_MIN]);
+void redir_restore(int saved[REDIR_FD_MIN]);
+int prealloc_cmd(char **parsed_args);
+
+/* script.c */
+int script_parse(char *text, const char *name, struct script *s);
+int script_load(const char *path, struct script *s);
+int script_run(struct script *s);
+
+/* history.c */
+void history_init(void);
+char *history_expand(char *line);
+void history_add(const char *line);
+int history_cmd(char **parsed_args);
+
 #endif	/* _SHELL_H_ */
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>		/* clock_gettime() */
+#include <sys/time.h>		/* struct timeval */
+#include <sys/resource.h>	/* getrusage() */
+
+#include "shell.h"
+
+/* nonzero while "stats on" is set or a "time" prefix is running */
+int stats_timing;
+
+/*
+ *	struct histogram - latency samples of one kind
+ *
+ *	@count	: samples recorded
+ *	@min	: smallest sample, in ns
+ *	@max	: largest sample, in ns
+ *	@sum	: sum of all samples, in ns
+ *	@bucket	: bucket[0] counts samples below 1 us, bucket[k] those in
+ *		  [2^(k-1), 2^k) us
+ */
+struct histogram
+{
+	unsigned long count;
+	long long min;
+	long long max;
+	long long sum;
+	unsigned long bucket[HIST_BUCKETS];
+};
+
+static const char *stat_names[N_STATS] =
+{
+	"command latency",
+	"fork/exec overhead",
+	"pipeline stage duration",
+};
+
+static struct histogram hist[N_STATS];
+
+/* set by "stats on" */
+static int stats_on;
+
+/*
+ *	struct time_acc - what a "time" prefix has seen so far
+ *
+ *	@active		: set between time_begin and time_end
+ *	@start		: wall clock at time_begin, in ns
+ *	@self		: usage of the shell itself at time_begin
+ *	@children	: summed usage of every process reaped since
+ */
+static struct
+{
+	int active;
+	long long start;
+	struct rusage self;
+	struct rusage children;
+} time_acc;
+
+
+/*
+ *	clock_ns
+ *
+ *	Return value
+ *		- CLOCK_MONOTONIC in ns; async-signal-safe
+ */
+long long clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/*
+ *	stats_record
+ *
+ *	Details:
+ *		- adds a sample of ns nanoseconds to the histogram of kind,
+ *		  nothing is recorded unless "stats on" is set
+ */
+void stats_record(enum stat_kind kind, long long ns)
+{
+	struct histogram *h = &hist[kind];
+	unsigned long long us = ns / 1000;
+	int k = 0;
+
+	if(!stats_on)
+	{
+		return;
+	}
+
+	if(us > 0)
+	{
+		k = 64 - __builtin_clzll(us);
+	}
+	if(k >= HIST_BUCKETS)
+	{
+		k = HIST_BUCKETS - 1;
+	}
+
+	if(h->count == 0 || ns < h->min)
+	{
+		h->min = ns;
+	}
+	if(ns > h->max)
+	{
+		h->max = ns;
+	}
+	h->sum += ns;
+	h->count++;
+	h->bucket[k]++;
+}
+
+
+/*
+ *	add_rusage - adds the usage of b to a, maxrss is the larger of both
+ */
+static void add_rusage(struct rusage *a, const struct rusage *b)
+{
+	timeradd(&a->ru_utime, &b->ru_utime, &a->ru_utime);
+	timeradd(&a->ru_stime, &b->ru_stime, &a->ru_stime);
+	if(b->ru_maxrss > a->ru_maxrss)
+	{
+		a->ru_maxrss = b->ru_maxrss;
+	}
+	a->ru_nvcsw += b->ru_nvcsw;
+	a->ru_nivcsw += b->ru_nivcsw;
+}
+
+
+/*
+ *	stats_job_done
+ *
+ *	Details:
+ *		- called when job leaves the job table, SIGCHLD must be blocked
+ *		- records the run time of every process started while timing
+ *		  was on, and adds its resource usage to a running "time"
+ */
+void stats_job_done(struct job *job)
+{
+	for(int i = 0; i < job->n_procs; i++)
+	{
+		struct process *p = &job->procs[i];
+
+		if(p->state != PROC_DONE || p->start_ns == 0)
+		{
+			continue;
+		}
+
+		stats_record(STAT_STAGE, p->end_ns - p->start_ns);
+		if(time_acc.active)
+		{
+			add_rusage(&time_acc.children, &p->ru);
+		}
+	}
+}
+
+
+/*
+ *	time_begin / time_end - the "time" prefix
+ *
+ *	Details:
+ *		- time_begin starts the clock and turns timing on for the
+ *		  command that follows
+ *		- time_end prints on stderr the wall time, the user and system
+ *		  time of the shell and of every child reaped in between
+ *		  (wait4 usage, so grandchildren that were waited for count
+ *		  too), the largest max RSS of those children and their
+ *		  context switches
+ */
+void time_begin(void)
+{
+	memset(&time_acc, 0, sizeof(time_acc));
+	getrusage(RUSAGE_SELF, &time_acc.self);
+	time_acc.active = 1;
+	stats_timing = 1;
+	time_acc.start = clock_ns();
+}
+
+void time_end(void)
+{
+	long long real = clock_ns() - time_acc.start;
+	struct rusage self, *c = &time_acc.children;
+	struct timeval user, sys;
+
+	getrusage(RUSAGE_SELF, &self);
+	time_acc.active = 0;
+	stats_timing = stats_on;
+
+	timersub(&self.ru_utime, &time_acc.self.ru_utime, &user);
+	timeradd(&user, &c->ru_utime, &user);
+	timersub(&self.ru_stime, &time_acc.self.ru_stime, &sys);
+	timeradd(&sys, &c->ru_stime, &sys);
+
+	fflush(stdout);
+	fprintf(stderr, "\nreal\t%lldm%.3fs\n", real / 60000000000LL,
+			(real % 60000000000LL) / 1e9);
+	fprintf(stderr, "user\t%ldm%.3fs\n", (long)user.tv_sec / 60,
+			(user.tv_sec % 60) + user.tv_usec / 1e6);
+	fprintf(stderr, "sys\t%ldm%.3fs\n", (long)sys.tv_sec / 60,
+			(sys.tv_sec % 60) + sys.tv_usec / 1e6);
+	fprintf(stderr, "maxrss\t%ld KiB\n", c->ru_maxrss);
+	fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n",
+			c->ru_nvcsw, c->ru_nivcsw);
+}
+
+
+/*
+ *	print_histogram
+ */
+static void print_histogram(const char *name, const struct histogram *h)
+{
+	unsigned long peak = 0;
+	int first = -1, last = 0;
+
+	printf("%s: %lu samples", name, h->count);
+	if(h->count == 0)
+	{
+		printf("\n\n");
+		return;
+	}
+	printf(", min %.3f ms, mean %.3f ms, max %.3f ms\n", h->min / 1e6,
+			(double)h->sum / h->count / 1e6, h->max / 1e6);
+
+	for(int k = 0; k < HIST_BUCKETS; k++)
+	{
+		if(h->bucket[k])
+		{
+			first = (first < 0) ? k : first;
+			last = k;
+			peak = (h->bucket[k] > peak) ? h->bucket[k] : peak;
+		}
+	}
+
+	printf("%12s %10s\n", "usec", "count");
+	for(int k = first; k <= last; k++)
+	{
+		unsigned long lo = k ? 1UL << (k - 1) : 0, hi = 1UL << k;
+		int bar = (h->bucket[k] * 40 + peak - 1) / peak;
+
+		printf("%5lu -%5lu %10lu%s", lo, hi, h->bucket[k],
+				bar ? "  " : "");
+		while(bar--)
+		{
+			putchar('#');
+		}
+		putchar('\n');
+	}
+	putchar('\n');
+}
+
+
+/*
+ *	stats_cmd - the "stats" builtin
+ *
+ *	Details:
+ *		- "stats on" / "stats off" start and stop recording, timing
+ *		  hooks cost nothing while it is off
+ *		- "stats reset" drops every sample
+ *		- "stats" prints a log2 histogram of every kind of sample
+ *
+ *	Return value
+ *		- 0 on success, 1 on an unknown argument
+ */
+int stats_cmd(char **parsed_args)
+{
+	if(!parsed_args[1])
+	{
+		if(!stats_on)
+		{
+			printf("stats are off, \"stats on\" starts recording\n");
+		}
+		for(int i = 0; i < N_STATS; i++)
+		{
+			print_histogram(stat_names[i], &hist[i]);
+		}
+		return 0;
+	}
+
+	if(strcmp(parsed_args[1], "on") == 0)
+	{
+		stats_on = 1;
+	}
+	else if(strcmp(parsed_args[1], "off") == 0)
+	{
+		stats_on = 0;
+	}
+	else if(strcmp(parsed_args[1], "reset") == 0)
+	{
+		memset(hist, 0, sizeof(hist));
+	}
+	else
+	{
+		fprintf(stderr, "usage: stats [on|off|reset]\n");
+		return 1;
+	}
+
+	stats_timing = stats_on || time_acc.active;
+	return 0;
+}
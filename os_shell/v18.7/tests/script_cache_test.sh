@@ -0,0 +1,102 @@
+#!/bin/sh
+#
+#	script_cache_test.sh
+#
+#	Damages the word kinds of a cached script in several ways and checks
+#	that my_shell still runs the script correctly, by rejecting the cache
+#	entry and parsing the script again, instead of crashing.
+#
+#	usage: tests/script_cache_test.sh [shell_binary]
+#
+
+MY_SHELL=${1:-./my_shell}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+export XDG_CACHE_HOME="$TMP/cache"
+
+# layout of the cache file (script.c): 64 byte struct script_header with
+# n_nodes at 48 and n_words at 52, 20 byte nodes, 8 byte words with the
+# kind at 4
+HDR_SIZE=64
+NODE_SIZE=20
+WORD_SIZE=8
+W_ARG=0
+W_PIPE=1
+
+cat > "$TMP/s.sh" <<'EOS'
+echo one two | cat
+if true; then
+	echo three four | tr a-z A-Z | cat
+fi
+echo five
+EOS
+
+expected=$(printf 'one two\nTHREE FOUR\nfive')
+fail=0
+
+u32_at()
+{
+	od -An -t u4 -j "$2" -N 4 "$1" | tr -d ' '
+}
+
+# sets the kind of word $2 of cache file $1 to $3
+set_kind()
+{
+	n_nodes=$(u32_at "$1" 48)
+	off=$((HDR_SIZE + n_nodes * NODE_SIZE + $2 * WORD_SIZE + 4))
+	printf "\\$(printf '%03o' "$3")" |
+		dd of="$1" bs=1 seek="$off" conv=notrunc 2>/dev/null
+}
+
+# runs the script, which rewrites the cache entry, and checks its output
+check()
+{
+	out=$("$MY_SHELL" "$TMP/s.sh" 2>/dev/null)
+	rc=$?
+	if [ "$rc" -ne 0 ] || [ "$out" != "$expected" ]; then
+		echo "FAIL: $1 (exit $rc)"
+		fail=1
+	else
+		echo "ok:   $1"
+	fi
+}
+
+check "first run, parsed"
+cache=$(find "$XDG_CACHE_HOME" -type f)
+if [ -z "$cache" ]; then
+	echo "FAIL: no cache entry written"
+	exit 1
+fi
+check "second run, from the cache"
+
+n_words=$(u32_at "$cache" 52)
+
+i=0
+while [ "$i" -lt "$n_words" ]; do
+	set_kind "$cache" "$i" "$W_PIPE"
+	i=$((i + 1))
+done
+check "every word a W_PIPE"
+
+set_kind "$cache" 0 "$W_PIPE"
+check "W_PIPE first"
+
+set_kind "$cache" $((n_words - 1)) "$W_PIPE"
+check "W_PIPE last"
+
+# "echo one two | cat": word 2 is "two", next to the W_PIPE at 3
+set_kind "$cache" 2 "$W_PIPE"
+check "W_PIPE next to a W_PIPE"
+
+# an extra stage: "echo | two | cat" has more stages than the node says
+set_kind "$cache" 1 "$W_PIPE"
+set_kind "$cache" 2 "$W_ARG"
+check "more W_PIPEs than stages"
+
+set_kind "$cache" 3 "$W_ARG"
+check "fewer W_PIPEs than stages"
+
+check "cache entry written again"
+
+exit $fail